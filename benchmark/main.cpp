@@ -1,4 +1,7 @@
 #include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <experimental/filesystem>
 #include "../src/savitar.hpp"
 #include "volatile/vector.hpp"
 #include "volatile/priority_queue.hpp"
@@ -86,12 +89,99 @@ int runRecoveryOverhead(int argc, char **argv) {
     return 0;
 }
 
+/*
+ * Removes the catalog, semantic logs and snapshots so that every run of the
+ * scaling benchmark starts from an empty persistent state (no recovery)
+ */
+void cleanPersistentState() {
+    namespace fs = experimental::filesystem;
+    for (auto &p : fs::directory_iterator(PMEM_PATH)) {
+        fs::path filePath = p.path();
+        if (filePath.filename() == CATALOG_FILE_NAME ||
+                filePath.extension() == ".log" ||
+                filePath.stem() == "snapshot") {
+            fs::remove(filePath);
+        }
+    }
+}
+
+/*
+ * Runs the benchmark for every placement policy and thread count (powers of
+ * two up to maxThreads) in a child process, as Savitar_main can only run once
+ * per process. Output: scaling,policy,threads,benchmark,latency,throughput
+ */
+template <class P, class T>
+int runScaling(const char *benchmark, string traceRoot, unsigned maxThreads,
+        string valueSize) {
+    int failures = 0;
+    for (int p = 0; p < PlacementPolicies; p++) {
+        PlacementPolicy policy = (PlacementPolicy)p;
+        for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            cleanPersistentState();
+            cout.flush();
+            pid_t pid = fork();
+            assert(pid >= 0);
+            if (pid == 0) {
+                string prefix = traceRoot + "/ycsb." + to_string(threads) + ".";
+                string threadCount = to_string(threads);
+                char *args[] = { (char *)"benchmark", (char *)benchmark,
+                    (char *)prefix.c_str(), (char *)threadCount.c_str(),
+                    (char *)valueSize.c_str(), NULL };
+                Savitar_config()->placement = policy;
+                PersistentFactory::registerFactory<P>();
+                cout << "scaling," << Savitar_placement_name(policy) << ",";
+                cout << threads << ",";
+                int status = Savitar_main(runNvBenchmark<T>, 5, args);
+                cout.flush();
+                exit(status);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                cerr << "scaling," << Savitar_placement_name(policy) << ",";
+                cerr << threads << "," << benchmark << ",failed" << endl;
+                failures++;
+            }
+        }
+    }
+    cleanPersistentState();
+    return failures;
+}
+
+int runScalingBenchmark(int argc, char **argv) {
+    string traceRoot = argv[2];
+    unsigned maxThreads = 1;
+    if (argc > 3) maxThreads = stoi(argv[3]);
+    string valueSize = "1024";
+    if (argc > 4) valueSize = argv[4];
+
+    int failures = 0;
+    failures += runScaling<PersistentVector, NvVector>(
+            "persistent-vector", traceRoot, maxThreads, valueSize);
+    failures += runScaling<PersistentPriorityQueue, NvPriorityQueue>(
+            "persistent-queue", traceRoot, maxThreads, valueSize);
+    failures += runScaling<PersistentMap, NvMap>(
+            "persistent-map", traceRoot, maxThreads, valueSize);
+    failures += runScaling<PersistentOrderedMap, NvOrderedMap>(
+            "persistent-ordered-map", traceRoot, maxThreads, valueSize);
+#ifdef MULTI_OBJECT
+    failures += runScaling<PersistentMap, NvHashMap>(
+            "persistent-hash-map", traceRoot, maxThreads, valueSize);
+#else
+    failures += runScaling<PersistentHashMap, NvHashMap>(
+            "persistent-hash-map", traceRoot, maxThreads, valueSize);
+#endif
+    return failures > 0 ? 1 : 0;
+}
+
 int main(int argc, char **argv) {
 
     if (argc < 3) {
         cout << "./benchmark benchmark workload-prefix";
         cout << " | recovery-configurations ";
         cout << "[threads] [value-size]" << endl;
+        cout << "./benchmark scaling trace-directory";
+        cout << " [max-threads] [value-size]" << endl;
         return 1;
     }
 
@@ -147,6 +237,9 @@ int main(int argc, char **argv) {
     else if (strcmp(argv[1], "recovery-overhead") == 0) {
         return runRecoveryOverhead(argc, argv);
     }
+    else if (strcmp(argv[1], "scaling") == 0) {
+        return runScalingBenchmark(argc, argv);
+    }
 
     return 1;
 }
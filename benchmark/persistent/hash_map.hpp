@@ -90,6 +90,14 @@ public:
         locks[b].unlock();
     }
 
+    // Inserts into different buckets commute, replay buckets in parallel
+    size_t Partitions() { return Buckets; }
+
+    size_t Partition(uint64_t tag, uint64_t *args) {
+        assert(tag == InsertTag);
+        return hash<string>{}((char *)args) % Buckets;
+    }
+
     // <compiler>
     PersistentHashMap() : PersistentObject(true) { }
 
@@ -105,16 +113,18 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static PersistentHashMap *Factory(uuid_t id) {
+    static PersistentHashMap *Factory(uuid_t id,
+            QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
         PersistentHashMap *obj =
-            (PersistentHashMap *)manager.findRecovered(id);
+            (PersistentHashMap *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<PersistentHashMap *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
@@ -47,16 +47,18 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static PersistentOrderedMap *Factory(uuid_t id) {
+    static PersistentOrderedMap *Factory(uuid_t id,
+            QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
         PersistentOrderedMap *obj =
-            (PersistentOrderedMap *)manager.findRecovered(id);
+            (PersistentOrderedMap *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<PersistentOrderedMap *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
@@ -52,15 +52,17 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static PersistentPriorityQueue *Factory(uuid_t id) {
+    static PersistentPriorityQueue *Factory(uuid_t id,
+            QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
-        PersistentPriorityQueue *obj = (PersistentPriorityQueue *)manager.findRecovered(id);
+        PersistentPriorityQueue *obj = (PersistentPriorityQueue *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<PersistentPriorityQueue *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
@@ -48,15 +48,17 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static PersistentMap *Factory(uuid_t id) {
+    static PersistentMap *Factory(uuid_t id,
+            QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
-        PersistentMap *obj = (PersistentMap *)manager.findRecovered(id);
+        PersistentMap *obj = (PersistentMap *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<PersistentMap *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
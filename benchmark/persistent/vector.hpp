@@ -44,15 +44,17 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static PersistentVector *Factory(uuid_t id) {
+    static PersistentVector *Factory(uuid_t id,
+            QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
-        PersistentVector *obj = (PersistentVector *)manager.findRecovered(id);
+        PersistentVector *obj = (PersistentVector *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<PersistentVector *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
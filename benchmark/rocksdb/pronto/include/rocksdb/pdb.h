@@ -2,6 +2,7 @@
 #include <uuid/uuid.h>
 #include <savitar.hpp>
 #include "rocksdb/db.h"
+#include "rocksdb/write_batch.h"
 #include <signal.h>
 
 namespace rocksdb {
@@ -63,15 +64,16 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static PDB *Factory(uuid_t id) {
+    static PDB *Factory(uuid_t id, QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
-        PDB *obj = (PDB *)manager.findRecovered(id);
+        PDB *obj = (PDB *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<PDB *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
@@ -150,6 +152,20 @@ public:
         return bytes_processed;
     }
 
+    // Consecutive puts are replayed as a single write batch
+    size_t ReplayBatchSize() { return 1024; }
+
+    void PlayBatch(const ReplayEntry *entries, size_t n) {
+        rocksdb::WriteBatch batch;
+        for (size_t i = 0; i < n; i++) {
+            assert(entries[i].tag == PutDefaultColumnFamily);
+            const char *key = (const char *)entries[i].args;
+            const char *value = key + strlen(key); // same as Play()
+            batch.Put(key, value);
+        }
+        db->Write(pWriteOptions, &batch);
+    }
+
     static uint64_t classID() { return __COUNTER__; }
     // </compiler>
 
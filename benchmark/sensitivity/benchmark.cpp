@@ -88,15 +88,18 @@ public:
         return BaseFactory(e->uuid);
     }
 
-    static BenchmarkObject *Factory(uuid_t id) {
+    static BenchmarkObject *Factory(uuid_t id,
+            QosClass qos_class = QosDefault) {
         NVManager &manager = NVManager::getInstance();
         manager.lock();
-        BenchmarkObject *obj = (BenchmarkObject *)manager.findRecovered(id);
+        BenchmarkObject *obj =
+            (BenchmarkObject *)manager.findRecovered(id, qos_class);
         if (obj == NULL) {
             obj = static_cast<BenchmarkObject *>(BaseFactory(id));
-            manager.createNew(classID(), obj);
+            manager.createNew(classID(), obj, qos_class);
         }
         manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
         return obj;
     }
 
@@ -1,5 +1,8 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include "savitar.hpp"
 #include "ckpt_alloc.hpp"
 #include <emmintrin.h>
@@ -11,8 +14,74 @@
  * * * * * * * * * *
  */
 GlobalAlloc* GlobalAlloc::instance = NULL;
+int GlobalAlloc::heap_fd = -1;
+heap_file_header_t *GlobalAlloc::heap_header = NULL;
+
+bool GlobalAlloc::openHeapFile(const char *path, const uuid_t generation,
+        size_t size) {
+    assert(instance == NULL && heap_fd < 0);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        PRINT("Unable to open heap file %s\n", path);
+        return false;
+    }
+
+    // An empty file (e.g., after a reboot) or a shorter one is not the heap
+    struct stat st;
+    bool keep = generation != NULL && fstat(fd, &st) == 0 &&
+        (size_t)st.st_size == size && size >= HeapHeaderSize;
+    bool discard = !keep;
+    if (discard && !truncateHeapFile(fd)) {
+        close(fd);
+        return false;
+    }
+    void *header = mmap(NULL, HeapHeaderSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    heap_header = (heap_file_header_t *)header;
+
+    // Same size, other contents (e.g., a copy of an older heap)
+    keep = keep && heap_header->magic == HeapFileMagic &&
+        uuid_compare(heap_header->generation, generation) == 0;
+    if (!keep && !discard && !truncateHeapFile(fd)) {
+        munmap(header, HeapHeaderSize);
+        heap_header = NULL;
+        close(fd);
+        return false;
+    }
 
-GlobalAlloc::GlobalAlloc(const char *snapshot, const char *bitmap) {
+    // The heap is modified from now on
+    heap_header->magic = HeapFileMagic;
+    uuid_clear(heap_header->generation);
+    msync(header, HeapHeaderSize, MS_SYNC);
+    heap_fd = fd;
+    PRINT("Heap is backed by %s (%s)\n", path, keep ? "warm" : "cold");
+    return keep;
+}
+
+// Discards the heap, only the header block is left (zero)
+bool GlobalAlloc::truncateHeapFile(int fd) {
+    return ftruncate(fd, 0) == 0 && ftruncate(fd, HeapHeaderSize) == 0;
+}
+
+// Returns 0 if the stamp is not saved (no warm restart)
+size_t GlobalAlloc::stampHeapFile(const uuid_t generation) {
+    if (heap_header == NULL) return 0; // the heap file could not be opened
+    if (fdatasync(heap_fd) != 0) return 0; // heap before its stamp
+    uuid_copy(heap_header->generation, generation);
+    struct stat st;
+    if (msync(heap_header, HeapHeaderSize, MS_SYNC) != 0 ||
+            fstat(heap_fd, &st) != 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+GlobalAlloc::GlobalAlloc(const char *snapshot, const char *bitmap,
+        bool populate) {
 
     assert(instance == NULL);
     assert(MinPoolSize % FreeList::BlockSize == 0);
@@ -29,13 +98,15 @@ GlobalAlloc::GlobalAlloc(const char *snapshot, const char *bitmap) {
     alloc_bitmap = (uint64_t *)malloc(bitmapSize());
     if (bitmap != NULL) memcpy(alloc_bitmap, bitmap, bitmapSize());
     else memset(alloc_bitmap, 0, bitmapSize());
+    block_owners = (uint16_t *)calloc(MaxMemorySize / FreeList::BlockSize,
+            sizeof(uint16_t));
 
     assert(pthread_mutex_init(&allocators_mutex, NULL) == 0);
     assert(pthread_mutex_init(&free_list_mutex, NULL) == 0);
     GlobalAlloc::instance = this;
 
     if (snapshot != NULL) {
-        load(snapshot);
+        load(snapshot, populate);
         return;
     }
 
@@ -53,6 +124,7 @@ GlobalAlloc::GlobalAlloc(const char *snapshot, const char *bitmap) {
 
 GlobalAlloc::~GlobalAlloc() {
     free(alloc_bitmap);
+    free(block_owners);
     std::list<memory_region_t>::iterator it;
     for (it = mapped_regions.begin(); it != mapped_regions.end(); ++it) {
         munmap(it->ptr, it->size);
@@ -72,21 +144,34 @@ size_t GlobalAlloc::bitmapSize() const {
     return (MaxMemorySize / BitmapGranularity) >> 3;
 }
 
-bool GlobalAlloc::newBlock(memory_region_t *region, uintptr_t addr, size_t size) {
+bool GlobalAlloc::newBlock(memory_region_t *region, uintptr_t addr, size_t size,
+        bool populate) {
 #ifdef DEBUG
     fprintf(stdout, "Requesting %zu bytes at %p from the kernel\n", size, (void*)addr);
 #endif
-    region->ptr = mmap((void *)addr, size, PROT_READ | PROT_WRITE, MAP_SHARED |
-            MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    int flags = MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB;
+    off_t offset = 0;
+    if (heap_fd >= 0) { // same offsets in the file as in the heap
+        flags = MAP_SHARED;
+        offset = HeapHeaderSize + addr - BaseAddress;
+        struct stat st;
+        if (fstat(heap_fd, &st) != 0) return false;
+        if ((size_t)st.st_size < offset + size &&
+                ftruncate(heap_fd, offset + size) != 0) return false;
+    }
+    if (populate) flags |= MAP_POPULATE;
+    region->ptr = mmap((void *)addr, size, PROT_READ | PROT_WRITE, flags,
+            heap_fd, offset);
     if (region->ptr == NULL) return false;
     if (region->ptr != (void *)addr) return false;
     region->size = size;
+    if (!populate) return true;
     if (madvise(region->ptr, region->size, MADV_SEQUENTIAL | MADV_WILLNEED) != 0)
         return false;
     return true;
 }
 
-void *GlobalAlloc::alloc(const size_t size) {
+void *GlobalAlloc::alloc(const size_t size, uint16_t owner) {
     void *ptr = NULL;
     free_header_t *head = free_list;
 
@@ -131,6 +216,12 @@ void *GlobalAlloc::alloc(const size_t size) {
         }
     }
 
+    if (owner != 0) {
+        size_t block = ((uintptr_t)ptr - BaseAddress) / FreeList::BlockSize;
+        size_t blocks = (size + FreeList::BlockSize - 1) / FreeList::BlockSize;
+        for (size_t b = block; b < block + blocks; b++) block_owners[b] = owner;
+    }
+
     pthread_mutex_unlock(&free_list_mutex);
     return ptr;
 }
@@ -184,6 +275,9 @@ void GlobalAlloc::release(void *ptr, size_t size) {
     t->size = size;
     if (free_list != NULL) free_list->prev = t;
     free_list = t;
+    size_t block = ((uintptr_t)ptr - BaseAddress) / FreeList::BlockSize;
+    size_t blocks = size / FreeList::BlockSize;
+    memset(&block_owners[block], 0, blocks * sizeof(uint16_t));
     tryMergingRegions(t);
     pthread_mutex_unlock(&free_list_mutex);
 }
@@ -301,7 +395,10 @@ size_t GlobalAlloc::snapshotSize() {
     sz += sizeof(uint64_t); // Total allocated
     sz += sizeof(uint64_t); // Size of free-list
     // Max number of free pages (address and size)
-    sz += ((MinPoolSize >> 21) << 1);
+    sz += MaxFreeRegions * 2 * sizeof(uint64_t);
+    // Block owners (allocator slots)
+    sz += sizeof(uint64_t);
+    sz += (MaxMemorySize / FreeList::BlockSize) * sizeof(uint16_t);
     return sz;
 }
 
@@ -324,12 +421,19 @@ void GlobalAlloc::save(char *nvm) const {
         *free_list_length = *free_list_length + 1;
         f = f->next;
     }
+    assert((size_t)*free_list_length <= MaxFreeRegions);
+
+    // Owners of mapped blocks
+    ptr = (long long *)nvm + 2 + MaxFreeRegions * 2;
+    long long *owned_blocks = ptr++;
+    *owned_blocks = *total_allocated / FreeList::BlockSize;
+    memcpy(ptr, block_owners, *owned_blocks * sizeof(uint16_t));
 
     _mm_clflush(total_allocated);
     //_mm_sfence();
 }
 
-void GlobalAlloc::load(const char *nvm) {
+void GlobalAlloc::load(const char *nvm, bool populate) {
     uint64_t *ptr = (uint64_t *)nvm;
     size_t pool_size = ptr[0];
     size_t free_list_length = ptr[1];
@@ -337,7 +441,7 @@ void GlobalAlloc::load(const char *nvm) {
 
     // reconstruct mapped_regions
     memory_region_t region;
-    assert(newBlock(&region, BaseAddress, pool_size));
+    assert(newBlock(&region, BaseAddress, pool_size, populate));
     asm volatile("" ::: "memory");
     mapped_regions.push_back(region);
 
@@ -357,6 +461,12 @@ void GlobalAlloc::load(const char *nvm) {
         ptr = ptr + 2;
     }
 
+    // reconstruct block owners
+    ptr = (uint64_t *)nvm + 2 + MaxFreeRegions * 2;
+    size_t owned_blocks = ptr[0];
+    assert(owned_blocks <= MaxMemorySize / FreeList::BlockSize);
+    memcpy(block_owners, ptr + 1, owned_blocks * sizeof(uint16_t));
+
 #if DEBUG
     fprintf(stdout, "------------------------------------------\n");
     fprintf(stdout, "Loaded the Global Allocator from snapshot\n");
@@ -438,6 +548,14 @@ ObjectAlloc *GlobalAlloc::findAllocator(uuid_t uuid) {
     return it->second;
 }
 
+uint16_t GlobalAlloc::allocatorSlot(const ObjectAlloc *alloc) const {
+    if (alloc < allocatorsMemory) return 0;
+    size_t slot = alloc - allocatorsMemory;
+    if (slot >= MaxAllocatorMemorySize / sizeof(ObjectAlloc)) return 0;
+    assert(slot < UINT16_MAX);
+    return slot + 1;
+}
+
 void GlobalAlloc::restoreAllocator(ObjectAlloc *alloc) {
     char uuid_str[64];
     uuid_unparse(alloc->my_id, uuid_str);
@@ -463,8 +581,9 @@ ObjectAlloc::ObjectAlloc(const uuid_t uuid, const char *snapshot) {
 
     // Create free lists
     free_lists = (FreeList **)malloc(sizeof(FreeList *) * cores);
+    uint16_t owner = GlobalAlloc::getInstance()->allocatorSlot(this);
     for (uint16_t c = 0; c < total_cores; c++) {
-        free_lists[c] = new FreeList(c);
+        free_lists[c] = new FreeList(c, owner);
     }
     uuid_copy(my_id, uuid);
 
@@ -644,7 +763,7 @@ const uint64_t FreeList::BucketCaps[14] = {
     0x40000, UINT64_MAX // 256 KB and above
 };
 
-FreeList::FreeList(uint16_t id) {
+FreeList::FreeList(uint16_t id, uint16_t owner) : owner(owner) {
     my_id = id;
     xlock = 0;
 #ifndef __OPTIMIZE__
@@ -775,7 +894,8 @@ chunk_header_t *FreeList::alloc(size_t size) {
 
     if (chunk == NULL) {
         // Not found, ask GlobalAlloc for more memory
-        chunk = (chunk_header_t *)GlobalAlloc::getInstance()->alloc(BlockSize);
+        chunk = (chunk_header_t *)GlobalAlloc::getInstance()->alloc(BlockSize,
+                owner);
 #ifndef __OPTIMIZE__
         chunk->used = 0;
         assert(chunk != NULL);
@@ -940,7 +1060,7 @@ chunk_header_t *FreeList::big_alloc(size_t size) {
     size_t allocSize = size & ~(BlockSize - 1);
     if (size > allocSize) allocSize += BlockSize;
 
-    void *ptr = GlobalAlloc::getInstance()->alloc(allocSize);
+    void *ptr = GlobalAlloc::getInstance()->alloc(allocSize, owner);
     chunk_header_t *chunk = (chunk_header_t *)ptr;
 
     chunk->prev_offset = 0;
@@ -43,22 +43,52 @@ typedef struct free_header_t {
     struct free_header_t *next;
 } free_header_t;
 
+/*
+ * First block of a heap file (warm restart), followed by the heap at the
+ * same offsets as in memory. The generation is the stamp of the warm state
+ * saved along with the heap, cleared once the heap is mapped again.
+ */
+typedef struct {
+    uint64_t magic;
+    uuid_t generation;
+} heap_file_header_t;
+
 /*
  * Manages the global heap
  * * Supplies ObjectAlloc with more memory.
  * * Responsible for fixed mapping between restarts.
  * * Maintains the list of allocated pages for snapshots.
+ * * Tracks the object allocator owning each block (for snapshot restore).
+ * * The heap is anonymous memory, or a shared file (e.g., on hugetlbfs) that
+ *   a restarting process can map again (warm restart, see openHeapFile).
  */
 class GlobalAlloc {
 public:
-    GlobalAlloc(const char *snapshot = NULL, const char *bitmap = NULL);
+    // populate = false leaves the pool unpopulated (lazy snapshot restore)
+    GlobalAlloc(const char *snapshot = NULL, const char *bitmap = NULL,
+            bool populate = true);
     ~GlobalAlloc();
     static GlobalAlloc *getInstance() {
         if (instance == NULL) instance = new GlobalAlloc();
         return instance;
     }
 
-    void *alloc(const size_t size);
+    /*
+     * Backs the heap with a shared file, must be called before the heap is
+     * mapped (i.e., before the first allocator is created)
+     * Returns true if the contents of the file are kept (warm restart), i.e.
+     * the file holds the given generation and has the given size. Otherwise
+     * the contents are discarded (cold start), or the heap stays anonymous
+     * if the file can not be used.
+     */
+    static bool openHeapFile(const char *path, const uuid_t generation,
+            size_t size);
+
+    // Saves the stamp of a warm state, returns the size of the heap file
+    static size_t stampHeapFile(const uuid_t generation);
+
+    // owner: allocator slot of the caller (0 if unknown)
+    void *alloc(const size_t size, uint16_t owner = 0);
     void release(void *ptr, size_t size);
 
     void setBitmap(uintptr_t, size_t);
@@ -68,7 +98,7 @@ public:
 
     static size_t snapshotSize();
     void save(char *) const;
-    void load(const char *);
+    void load(const char *, bool populate = true);
 
     size_t bitmapSize() const;
     void saveBitmap(char *) const;
@@ -81,14 +111,25 @@ public:
     ObjectAlloc *findAllocator(uuid_t);
     void restoreAllocator(ObjectAlloc *);
 
+    /*
+     * Allocator slots are stable between restarts (allocators are restored
+     * in place), 0 is used for memory not owned by an object allocator
+     */
+    uint16_t allocatorSlot(const ObjectAlloc *) const;
+    const uint16_t *blockOwners() const { return block_owners; }
+
 protected:
-    bool newBlock(memory_region_t *, uintptr_t, size_t);
+    bool newBlock(memory_region_t *, uintptr_t, size_t, bool populate = true);
     void tryMergingRegions(free_header_t *);
 
 private:
     static GlobalAlloc *instance;
+    static int heap_fd;
+    static heap_file_header_t *heap_header;
+    static bool truncateHeapFile(int fd);
 
     uint64_t *alloc_bitmap = NULL;
+    uint16_t *block_owners = NULL;
     pthread_mutex_t free_list_mutex;
     pthread_mutex_t allocators_mutex;
 
@@ -103,6 +144,9 @@ public:
     static const size_t BitmapGranularity = (size_t)1 << 12; // 4 KB
     static const uintptr_t BaseAddress = 0x10000000000;
     static const size_t MinPoolSize = (size_t)256 << 20; // 256 MB
+    static const size_t HeapHeaderSize = (size_t)2 << 20; // one huge page
+    static const uint64_t HeapFileMagic = 0x5761726D48656170; // WarmHeap
+    static const size_t MaxFreeRegions = MinPoolSize >> 21; // in snapshots
     static_assert(((size_t)1 << 12) == BitmapGranularity,
             "Fix bitmap set and unset methods!");
     static_assert(sizeof(long long) == sizeof(uint64_t),
@@ -162,7 +206,7 @@ public:
  */
 class FreeList {
 public:
-    FreeList(uint16_t);
+    FreeList(uint16_t, uint16_t owner = 0);
     ~FreeList();
 
     void lock();
@@ -190,6 +234,7 @@ private:
     uint64_t chain_lookups; // number of free-list lookups
     uint64_t xlock;
     uint16_t my_id;
+    uint16_t owner; // allocator slot (see GlobalAlloc::allocatorSlot)
 #ifndef __OPTIMIZE__
     uint64_t lock_holders;
 #endif
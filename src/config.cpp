@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+#include "config.hpp"
+#include "savitar.hpp"
+
+static uint64_t env_uint64(const char *name, uint64_t default_value) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') return default_value;
+    return strtoull(value, NULL, 10);
+}
+
+static const char *placement_names[PlacementPolicies] = {
+    "ht", "core", "socket", "none"
+};
+
+const char *Savitar_placement_name(PlacementPolicy policy) {
+    assert(policy < PlacementPolicies);
+    return placement_names[policy];
+}
+
+static const char *qos_mode_names[QosModes] = {
+    "off", "stats", "priority", "dedicated"
+};
+
+static const char *qos_class_names[QosClasses] = { "default", "critical" };
+
+const char *Savitar_qos_name(QosClass qos_class) {
+    assert(qos_class < QosClasses);
+    return qos_class_names[qos_class];
+}
+
+static void load_config(SavitarConfig *cfg) {
+    cfg->logging_mode = LoggingAsync;
+    const char *mode = getenv("PRONTO_LOGGING");
+    if (mode != NULL && strcmp(mode, "hybrid") == 0) {
+        cfg->logging_mode = LoggingHybrid;
+    }
+    cfg->hybrid_threshold = env_uint64("PRONTO_HYBRID_THRESHOLD",
+            HYBRID_THRESHOLD);
+
+#ifdef NO_HT_PINNING
+    cfg->placement = PlacementPhysicalCore;
+#else
+    cfg->placement = PlacementHTSibling;
+#endif
+    const char *placement = getenv("PRONTO_PLACEMENT");
+    for (int p = 0; placement != NULL && p < PlacementPolicies; p++) {
+        if (strcmp(placement, placement_names[p]) == 0) {
+            cfg->placement = (PlacementPolicy)p;
+        }
+    }
+
+    cfg->qos_mode = QosOff;
+    const char *qos = getenv("PRONTO_QOS");
+    for (int m = 0; qos != NULL && m < QosModes; m++) {
+        if (strcmp(qos, qos_mode_names[m]) == 0) cfg->qos_mode = (QosMode)m;
+    }
+    cfg->qos_max_defer = env_uint64("PRONTO_QOS_MAX_DEFER", QOS_MAX_DEFER);
+    cfg->recovery_threads = env_uint64("PRONTO_RECOVERY_THREADS", 0);
+    cfg->recovery_mode = RecoveryEager;
+    const char *recovery = getenv("PRONTO_RECOVERY");
+    if (recovery != NULL && strcmp(recovery, "lazy") == 0) {
+        cfg->recovery_mode = RecoveryLazy;
+    }
+    cfg->recovery_pipeline_bytes = env_uint64("PRONTO_RECOVERY_PIPELINE",
+            RECOVERY_PIPELINE_BYTES);
+    cfg->restore_mode = RestoreLazy;
+    const char *restore = getenv("PRONTO_SNAPSHOT_RESTORE");
+    if (restore != NULL && strcmp(restore, "eager") == 0) {
+        cfg->restore_mode = RestoreEager;
+    }
+    cfg->recovery_report = getenv("PRONTO_RECOVERY_REPORT");
+    cfg->shutdown_snapshot = env_uint64("PRONTO_SHUTDOWN_SNAPSHOT", 0) != 0;
+    cfg->warm_heap = getenv("PRONTO_WARM_HEAP");
+    cfg->incremental_snapshots = env_uint64("PRONTO_INCREMENTAL_SNAPSHOTS", 0);
+    cfg->snapshot_threads = env_uint64("PRONTO_SNAPSHOT_THREADS", 0);
+    cfg->snapshot_writers = env_uint64("PRONTO_SNAPSHOT_WRITERS", 8);
+    cfg->recovery_objective = env_uint64("PRONTO_RECOVERY_OBJECTIVE", 0);
+    cfg->snapshot_interval = env_uint64("PRONTO_SNAPSHOT_INTERVAL", 1000);
+    cfg->replay_rate = env_uint64("PRONTO_REPLAY_RATE", REPLAY_RATE);
+    cfg->snapshot_retain = env_uint64("PRONTO_SNAPSHOT_RETAIN", 0);
+    cfg->snapshot_retain_time = env_uint64("PRONTO_SNAPSHOT_RETAIN_TIME", 0);
+    cfg->snapshot_holes = env_uint64("PRONTO_SNAPSHOT_HOLES", 1) != 0;
+
+    PRINT("Runtime configuration: logging = %d, hybrid threshold = %zu\n",
+            cfg->logging_mode, cfg->hybrid_threshold);
+    PRINT("Runtime configuration: placement = %s\n",
+            placement_names[cfg->placement]);
+    PRINT("Runtime configuration: qos = %s, max defer = %zu\n",
+            qos_mode_names[cfg->qos_mode], cfg->qos_max_defer);
+    PRINT("Runtime configuration: recovery threads = %zu, lazy = %d\n",
+            cfg->recovery_threads, cfg->recovery_mode == RecoveryLazy);
+    PRINT("Runtime configuration: lazy snapshot restore = %d\n",
+            cfg->restore_mode == RestoreLazy);
+    PRINT("Runtime configuration: shutdown snapshot = %d\n",
+            cfg->shutdown_snapshot);
+    PRINT("Runtime configuration: warm heap = %s\n",
+            cfg->warm_heap != NULL ? cfg->warm_heap : "none");
+    PRINT("Runtime configuration: incremental snapshots = %zu\n",
+            cfg->incremental_snapshots);
+    PRINT("Runtime configuration: snapshot threads = %zu, writers = %zu\n",
+            cfg->snapshot_threads, cfg->snapshot_writers);
+    PRINT("Runtime configuration: recovery objective = %zu ms, "
+            "snapshot interval = %zu ms, replay rate = %zu MB/s\n",
+            cfg->recovery_objective, cfg->snapshot_interval, cfg->replay_rate);
+    PRINT("Runtime configuration: retained snapshots = %zu, retain time = %zu s\n",
+            cfg->snapshot_retain, cfg->snapshot_retain_time);
+    PRINT("Runtime configuration: snapshot holes = %d\n", cfg->snapshot_holes);
+}
+
+SavitarConfig *Savitar_config() {
+    static SavitarConfig config;
+    static bool initialized = false;
+    if (!initialized) {
+        load_config(&config);
+        initialized = true;
+    }
+    return &config;
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Runtime configuration
+ * * Build-time switches (e.g., SYNC_SL) still select what is compiled in.
+ * * Everything else is read once from the environment (PRONTO_*) on the
+ *   first call to Savitar_config(), and can be overridden by the program
+ *   before calling Savitar_main().
+ */
+typedef enum {
+    LoggingAsync = 0,   // ASL: persister threads create all log entries
+    LoggingHybrid = 1,  // worker takes over when its persister falls behind
+} LoggingMode;
+
+/*
+ * Placement of persister threads with respect to their worker threads
+ * (ignored when SYNC_SL is defined, since there are no persister threads)
+ */
+typedef enum {
+    PlacementHTSibling = 0,     // hyper-thread siblings of one physical core
+    PlacementPhysicalCore = 1,  // dedicated physical cores on the same socket
+    PlacementSocket = 2,        // persister may run anywhere in the socket (L3)
+    PlacementNone = 3,          // no pinning, left to the OS scheduler
+    PlacementPolicies = 4
+} PlacementPolicy;
+
+/*
+ * Quality of service classes of persistent objects (see NVManager::createNew)
+ * Latency-critical objects can be isolated from bulk traffic that shares
+ * persister capacity with them.
+ */
+typedef enum {
+    QosDefault = 0,
+    QosCritical = 1,
+    QosClasses = 2
+} QosClass;
+
+typedef enum {
+    QosOff = 0,         // no per-class tracking
+    QosStats = 1,       // per-class latency statistics only
+    QosPriority = 2,    // persisters defer default requests to critical ones
+    QosDedicated = 3,   // critical requests are logged by their worker thread
+    QosModes = 4
+} QosMode;
+
+typedef enum {
+    RecoveryEager = 0,  // Savitar_main waits for all objects to recover
+    RecoveryLazy = 1,   // objects recover in the background (on demand)
+} RecoveryMode;
+
+typedef enum {
+    RestoreEager = 0,   // heap pages are copied from the snapshot on startup
+    RestoreLazy = 1,    // pages are copied on first access (userfaultfd)
+} RestoreMode;
+
+typedef struct SavitarConfig {
+    /*
+     * PRONTO_LOGGING = async | hybrid
+     * PRONTO_HYBRID_THRESHOLD = cycles the worker waits for its persister
+     * to pick up a request before creating the log entry inline
+     */
+    LoggingMode logging_mode;
+    uint64_t hybrid_threshold;
+
+    // PRONTO_PLACEMENT = ht | core | socket | none
+    PlacementPolicy placement;
+
+    /*
+     * PRONTO_QOS = off | stats | priority | dedicated (requires persisters)
+     * PRONTO_QOS_MAX_DEFER = cycles a persister may defer a default request
+     * while critical requests are pending (bounds starvation)
+     */
+    QosMode qos_mode;
+    uint64_t qos_max_defer;
+
+    // PRONTO_RECOVERY_THREADS = size of the recovery pool (0 = online cores)
+    uint64_t recovery_threads;
+
+    // PRONTO_RECOVERY = eager | lazy
+    RecoveryMode recovery_mode;
+
+    /*
+     * PRONTO_RECOVERY_PIPELINE = minimum log bytes for scanning the log on
+     * a separate thread while replaying it (0 = never)
+     */
+    uint64_t recovery_pipeline_bytes;
+
+    /*
+     * PRONTO_SNAPSHOT_RESTORE = lazy | eager
+     * Lazy restore falls back to eager if userfaultfd(2) is not available.
+     */
+    RestoreMode restore_mode;
+
+    // PRONTO_RECOVERY_REPORT = file for recovery reports (see RecoveryReport)
+    const char *recovery_report;
+
+    /*
+     * PRONTO_SHUTDOWN_SNAPSHOT = 1 takes a snapshot on clean shutdown and
+     * truncates the logs, so that the next startup replays nothing
+     */
+    bool shutdown_snapshot;
+
+    /*
+     * PRONTO_WARM_HEAP = file backing the heap (e.g., on hugetlbfs), kept
+     * across clean restarts so that the next startup maps it instead of
+     * restoring a snapshot and replaying the logs
+     */
+    const char *warm_heap;
+
+    /*
+     * PRONTO_INCREMENTAL_SNAPSHOTS = incremental snapshots taken on top of a
+     * full snapshot before the next full one (0 = full snapshots only)
+     * Writes to the heap are tracked with mprotect(2) between snapshots.
+     */
+    uint64_t incremental_snapshots;
+
+    /*
+     * PRONTO_SNAPSHOT_THREADS = threads saving or restoring snapshot pages
+     * (0 = online cores)
+     * PRONTO_SNAPSHOT_WRITERS = at most this many of them write to NVM while
+     * saving a snapshot (0 = no limit)
+     */
+    uint64_t snapshot_threads;
+    uint64_t snapshot_writers;
+
+    /*
+     * PRONTO_RECOVERY_OBJECTIVE = bound on the predicted replay time (ms)
+     * kept by taking snapshots in the background (0 = SIGUSR1 or
+     * Savitar_snapshot() only, see SnapshotScheduler)
+     * PRONTO_SNAPSHOT_INTERVAL = minimum time between scheduled snapshots (ms)
+     * PRONTO_REPLAY_RATE = replay rate of a recovery thread (MB/s) used until
+     * a recovery of the program has measured it
+     */
+    uint64_t recovery_objective;
+    uint64_t snapshot_interval;
+    uint64_t replay_rate;
+
+    /*
+     * PRONTO_SNAPSHOT_RETAIN = complete snapshots kept on disk
+     * PRONTO_SNAPSHOT_RETAIN_TIME = snapshots younger than this are kept (s)
+     * A snapshot is kept if either rule keeps it, with both set to 0 (the
+     * default) snapshots are never deleted. The latest complete snapshot
+     * and the bases of kept incremental snapshots are always kept.
+     */
+    uint64_t snapshot_retain;
+    uint64_t snapshot_retain_time;
+
+    /*
+     * PRONTO_SNAPSHOT_HOLES = 1 leaves pages that only hold zeros out of
+     * snapshot files (sparse), 0 writes the full image of used blocks
+     */
+    bool snapshot_holes;
+} SavitarConfig;
+
+SavitarConfig *Savitar_config();
+
+const char *Savitar_placement_name(PlacementPolicy);
+
+const char *Savitar_qos_name(QosClass);
@@ -4,14 +4,17 @@
 #include "thread.hpp"
 #include "nvm_manager.hpp"
 #include "snapshot.hpp"
+#include "snapshot_scheduler.hpp"
 #include <execinfo.h>
 
 static pthread_t snapshot_thread;
 static pthread_mutex_t snapshot_lock;
+static SnapshotScheduler *scheduler = NULL;
 
 static void *snapshot_worker(void *arg) {
     Snapshot *snap = (Snapshot *)arg;
     snap->create();
+    snap->collectExpired();
     delete snap;
     return NULL;
 }
@@ -21,6 +24,9 @@ static void signal_handler(int sig, siginfo_t *si, void *unused) {
     if (sig == SIGSEGV) {
         void *addr = si->si_addr;
         if (!Snapshot::anyActiveSnapshot()) {
+            // First write to a block since the last (incremental) snapshot
+            if (Snapshot::trackWrite(addr)) return;
+
             void *array[10];
             size_t size;
 
@@ -41,6 +47,27 @@ static void signal_handler(int sig, siginfo_t *si, void *unused) {
     }
 }
 
+uint32_t Savitar_snapshot() {
+    // SIGUSR1 would deadlock on snapshot_lock in this thread
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    pthread_mutex_lock(&snapshot_lock);
+    if (Snapshot::anyActiveSnapshot()) {
+        pthread_join(snapshot_thread, NULL);
+    }
+    Snapshot *snap = new Snapshot(PMEM_PATH);
+    uint32_t id = snap->create();
+    snap->collectExpired();
+    delete snap;
+    pthread_mutex_unlock(&snapshot_lock);
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    return id;
+}
+
 typedef struct main_arguments {
     MainFunction main;
     int argc;
@@ -56,6 +83,7 @@ static void *main_wrapper(void *arg) {
 
 int Savitar_main(MainFunction main_function, int argc, char **argv) {
 
+    Savitar_config(); // read runtime configuration
 #ifndef SYNC_SL
     Savitar_core_init();
 #endif // SYNC_SL
@@ -71,6 +99,10 @@ int Savitar_main(MainFunction main_function, int argc, char **argv) {
     assert(sigaction(SIGSEGV, &sa, NULL) == 0);
     assert(sigaction(SIGUSR1, &sa, NULL) == 0);
 
+    // Background snapshots (PRONTO_RECOVERY_OBJECTIVE)
+    scheduler = SnapshotScheduler::create();
+    if (scheduler != NULL) scheduler->start();
+
     int *status;
     pthread_t main_thread;
     MainArguments args = {
@@ -80,6 +112,12 @@ int Savitar_main(MainFunction main_function, int argc, char **argv) {
     };
     Savitar_thread_create(&main_thread, NULL, main_wrapper, &args);
     pthread_join(main_thread, (void **)&status);
+    NVManager::getInstance().waitForRecovery(); // lazy recovery
+    if (scheduler != NULL) {
+        scheduler->stop();
+        delete scheduler;
+        scheduler = NULL;
+    }
 
     // Wait for active snapshots to complete
     pthread_mutex_lock(&snapshot_lock);
@@ -90,8 +128,50 @@ int Savitar_main(MainFunction main_function, int argc, char **argv) {
 
 #ifndef SYNC_SL
     Savitar_core_finalize();
+    if (Savitar_config()->logging_mode == LoggingHybrid) {
+        uint64_t async_entries, inline_entries;
+        Savitar_logging_stats(&async_entries, &inline_entries);
+        fprintf(stdout, "Hybrid Logging (async/inline)\t%zu\t%zu\n",
+                async_entries, inline_entries);
+    }
+    for (int c = 0; Savitar_config()->qos_mode != QosOff && c < QosClasses; c++) {
+        QosLatency latency;
+        Savitar_qos_stats((QosClass)c, &latency);
+        if (latency.operations == 0) continue;
+        fprintf(stdout, "QoS Latency (%s: ops/avg/p50/p99/max)\t%zu\t%zu\t%zu\t%zu\t%zu\n",
+                Savitar_qos_name((QosClass)c), latency.operations,
+                latency.total_cycles / latency.operations,
+                latency.p50_cycles, latency.p99_cycles, latency.max_cycles);
+    }
 #endif // SYNC_SL
+
+    // Final snapshot, SIGUSR1 snapshots are postponed (snapshot_lock)
+    if (Savitar_config()->shutdown_snapshot) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+        pthread_mutex_lock(&snapshot_lock);
+        NVManager::getInstance().shutdownCheckpoint();
+        pthread_mutex_unlock(&snapshot_lock);
+    }
+
+    SnapshotLatency snapshots;
+    Savitar_snapshot_stats(&snapshots);
+    if (snapshots.snapshots > 0) {
+        fprintf(stdout, "Snapshot Sync Latency (us: count/avg/p50/p99/max)\t%zu\t%zu\t%zu\t%zu\t%zu\n",
+                snapshots.snapshots, snapshots.total_us / snapshots.snapshots,
+                snapshots.p50_us, snapshots.p99_us, snapshots.max_us);
+    }
+
+    // Allocator state for the next process to map the heap file again
+    if (Savitar_config()->warm_heap != NULL) {
+        pthread_mutex_lock(&snapshot_lock);
+        NVManager::getInstance().saveWarmState();
+        pthread_mutex_unlock(&snapshot_lock);
+    }
     pthread_mutex_destroy(&snapshot_lock);
+    Snapshot::waitForCollector();
 
     int ret_val = *status;
     free(status);
@@ -1,7 +1,10 @@
 #include <libpmem.h>
+#include <pthread.h>
 #include <uuid/uuid.h>
 #include <fstream>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #include "nv_log.hpp"
 #include "savitar.hpp"
 
@@ -9,6 +12,10 @@
 
 static const uint64_t LogMagic = REDO_LOG_MAGIC;
 
+// Shared by barriers of all objects, as barriers are rare
+static pthread_mutex_t barrier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t barrier_drained = PTHREAD_COND_INITIALIZER;
+
 void Savitar_log_path(uuid_t uuid, char *path) {
     assert(uuid_is_null(uuid) == 0);
 
@@ -26,6 +33,17 @@ bool Savitar_log_exists(uuid_t uuid) {
     std::ifstream f(path);
     return f.good();
 }
+bool Savitar_log_read_header(uuid_t id, SavitarLog *header) {
+    char path[255];
+    Savitar_log_path(id, path);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    ssize_t bytes = pread(fd, header, sizeof(SavitarLog), 0);
+    close(fd);
+    return bytes == sizeof(SavitarLog) && header->checksum == CHECKSUM(header);
+}
+
 SavitarLog *Savitar_log_open(uuid_t id) {
     char path[255];
     size_t mapped_len;
@@ -36,7 +54,6 @@ SavitarLog *Savitar_log_open(uuid_t id) {
             &mapped_len, NULL);
     assert(log == NULL || log->size == mapped_len);
     assert(log == NULL || log->checksum == CHECKSUM(log));
-    if (log != NULL) log->snapshot_lock = 0;
     return log;
 }
 
@@ -54,8 +71,8 @@ SavitarLog *Savitar_log_create(uuid_t id, size_t size) {
         assert(sizeof(struct RedoLog) == CACHE_LINE_WIDTH);
         log->tail = sizeof(struct RedoLog);
         log->head = log->tail;
-        log->last_commit = 0;
-        log->snapshot_lock = 0;
+        log->watermark_commit = 0;
+        log->watermark_offset = log->head;
         log->checksum = CHECKSUM(log);
         pmem_persist(log, sizeof(struct RedoLog));
         PRINT("Created new semantic log at %s\n", path);
@@ -100,8 +117,46 @@ uint64_t Savitar_log_append(struct RedoLog *log, ArgVector *v, size_t v_size) {
     return offset;
 }
 
-void Savitar_log_commit(SavitarLog *log, uint64_t entry_offset) {
-    uint64_t commit_id = __sync_add_and_fetch(&log->last_commit, 1);
+LogControl *Savitar_log_control_create() {
+    void *ptr = NULL;
+    assert(sizeof(LogControl) == 3 * CACHE_LINE_WIDTH);
+    assert(posix_memalign(&ptr, CACHE_LINE_WIDTH, sizeof(LogControl)) == 0);
+    memset(ptr, 0, sizeof(LogControl));
+    return (LogControl *)ptr;
+}
+
+void Savitar_log_barrier(LogControl *control) {
+    if (control->inflight_ops[0] == 0 && control->inflight_ops[1] == 0) return;
+
+    // Counted before reading inflight_ops (see Savitar_log_end_op)
+    __sync_fetch_and_add(&control->barrier_waiters, 1);
+    pthread_mutex_lock(&barrier_lock);
+    // Concurrent barriers must not flip the epoch before the previous drains
+    while (control->barrier_active) {
+        pthread_cond_wait(&barrier_drained, &barrier_lock);
+    }
+    control->barrier_active = 1;
+    uint64_t epoch = control->barrier_epoch;
+    control->barrier_epoch = 1 - epoch;
+    __sync_synchronize();
+    while (control->inflight_ops[epoch] != 0) {
+        pthread_cond_wait(&barrier_drained, &barrier_lock);
+    }
+    control->barrier_active = 0;
+    pthread_cond_broadcast(&barrier_drained);
+    pthread_mutex_unlock(&barrier_lock);
+    __sync_fetch_and_sub(&control->barrier_waiters, 1);
+}
+
+void Savitar_log_barrier_wake() {
+    pthread_mutex_lock(&barrier_lock);
+    pthread_cond_broadcast(&barrier_drained);
+    pthread_mutex_unlock(&barrier_lock);
+}
+
+void Savitar_log_commit(SavitarLog *log, LogControl *control,
+        uint64_t entry_offset) {
+    uint64_t commit_id = __sync_add_and_fetch(&control->last_commit, 1);
     assert(commit_id < UINT64_MAX);
     uint64_t *ptr = (uint64_t *)((char *)log + entry_offset);
     *ptr = commit_id;
@@ -109,3 +164,26 @@ void Savitar_log_commit(SavitarLog *log, uint64_t entry_offset) {
     PRINT("[%d] Marked log entry (%zu) as committed with id = %zu\n",
             (int)pthread_self(), entry_offset, commit_id);
 }
+
+/*
+ * The commit id is persisted before the offset: a crash in between leaves
+ * an older offset with a newer commit id, which only makes the fixup scan
+ * more entries (it ignores commit ids up to the watermark)
+ */
+void Savitar_log_watermark(SavitarLog *log, uint64_t commit_id,
+        uint64_t offset) {
+    assert(offset <= log->tail);
+    if (commit_id < log->watermark_commit) return;
+    if (offset < log->watermark_offset) return;
+    log->watermark_commit = commit_id;
+    pmem_persist(&log->watermark_commit, sizeof(uint64_t));
+    log->watermark_offset = offset;
+    pmem_persist(&log->watermark_offset, sizeof(uint64_t));
+    PRINT("Advanced log watermark to commit %zu at offset %zu\n",
+            commit_id, offset);
+}
+
+void Savitar_log_truncate(SavitarLog *log) {
+    log->head = log->tail;
+    pmem_persist(&log->head, sizeof(uint64_t));
+}
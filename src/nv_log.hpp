@@ -8,7 +8,10 @@
  * object_id: uuid of persistent object corresponding to the log
  * size: log size including the header
  * head/tail: offset of entries from the beginning of mapped region
- * last_commit: does not need to be persistent (can be recovered from entries)
+ * watermark_commit/offset: entries before watermark_offset were checked for
+ * aborted transactions, and all commits up to watermark_commit are in the
+ * log, so crash fixup only scans the tail (see Savitar_log_watermark)
+ * Volatile coordination state lives in the DRAM control block (LogControl).
  */
 typedef struct RedoLog {
     uint64_t checksum;
@@ -16,10 +19,29 @@ typedef struct RedoLog {
     uint64_t size;
     uint64_t head;
     uint64_t tail;
-    uint64_t last_commit;
-    uint64_t snapshot_lock; // temporary value
+    uint64_t watermark_commit;
+    uint64_t watermark_offset; // header is one cache line
 } SavitarLog;
 
+/*
+ * DRAM-resident control block of a semantic log (one per object)
+ * last_commit: updated by every commit, recovered from the log entries
+ * barrier_epoch/qos_class: read by every operation, rarely written
+ * inflight_ops/barrier_*: durability barrier (see Savitar_log_barrier)
+ * Each group sits on its own cache line to avoid false sharing.
+ */
+typedef struct LogControl {
+    volatile uint64_t last_commit;
+    char padding0[64 - sizeof(uint64_t)];
+    volatile uint64_t barrier_epoch;
+    uint64_t qos_class;
+    char padding1[64 - 2 * sizeof(uint64_t)];
+    volatile uint64_t inflight_ops[2];
+    uint64_t barrier_active;
+    volatile uint64_t barrier_waiters;
+    char padding2[64 - 4 * sizeof(uint64_t)];
+} LogControl;
+
 typedef struct SavitarVector {
     void *addr;
     size_t len;
@@ -30,5 +52,51 @@ SavitarLog *Savitar_log_create(uuid_t, size_t);
 void Savitar_log_close(SavitarLog *);
 
 bool Savitar_log_exists(uuid_t);
+
+/*
+ * Reads the header of an existing log without mapping it (startup), returns
+ * false if the log does not exist or is not initialized
+ */
+bool Savitar_log_read_header(uuid_t, SavitarLog *header);
 uint64_t Savitar_log_append(SavitarLog *, ArgVector *, size_t);
-void Savitar_log_commit(SavitarLog *, uint64_t);
+void Savitar_log_commit(SavitarLog *, LogControl *, uint64_t);
+
+/*
+ * Advances the watermark of the log, only at points where no transaction
+ * on the object is running or pending (snapshots and the end of recovery)
+ */
+void Savitar_log_watermark(SavitarLog *, uint64_t commit_id, uint64_t offset);
+
+/*
+ * Drops all entries of the log, which must be covered by a snapshot (objects
+ * restored from a snapshot are replayed from the log tail saved with it)
+ */
+void Savitar_log_truncate(SavitarLog *);
+
+LogControl *Savitar_log_control_create();
+
+/*
+ * Durability barrier of an object (see Savitar_barrier)
+ * Operations are counted in the barrier epoch they started in. A barrier
+ * flips the epoch and sleeps until the previous one drains, so operations
+ * re-check the epoch after counting themselves in, and the last operation
+ * of an epoch wakes up waiting barriers.
+ */
+void Savitar_log_barrier(LogControl *);
+void Savitar_log_barrier_wake();
+
+inline void Savitar_log_end_op(LogControl *control, uint64_t epoch) {
+    if (__sync_sub_and_fetch(&control->inflight_ops[epoch], 1) == 0 &&
+            control->barrier_waiters != 0) {
+        Savitar_log_barrier_wake();
+    }
+}
+
+inline uint64_t Savitar_log_begin_op(LogControl *control) {
+    while (true) {
+        uint64_t epoch = control->barrier_epoch;
+        __sync_fetch_and_add(&control->inflight_ops[epoch], 1);
+        if (control->barrier_epoch == epoch) return epoch;
+        Savitar_log_end_op(control, epoch); // flipped by a barrier meanwhile
+    }
+}
@@ -2,11 +2,18 @@
 #include <stdio.h>
 #include <cstring>
 #include <queue>
+#include <vector>
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
 #include "nv_object.hpp"
 #include "nv_log.hpp"
 #include "savitar.hpp"
 #include "nvm_manager.hpp"
 #include "recovery_context.hpp"
+#include "recovery_graph.hpp"
+#include "recovery_pool.hpp"
+#include "recovery_report.hpp"
 
 /*
  * Constructor is only called for new objects:
@@ -35,6 +42,8 @@ void PersistentObject::constructor(uuid_t id) {
     else {
         log = Savitar_log_create(uuid, LOG_SIZE);
     }
+    // last_commit is restored by the recovery worker for existing logs
+    control = Savitar_log_control_create();
 }
 
 PersistentObject::PersistentObject(bool dummy) {
@@ -51,33 +60,75 @@ PersistentObject::~PersistentObject() {
     manager.unlock();
 }
 
-class CommitRecord {
-    public:
-        CommitRecord(char *ptr, uint64_t commit_id, uint64_t method_tag) {
-            _ptr = ptr;
-            _commit_id = commit_id;
-            _method_tag = method_tag;
-        }
+void PersistentObject::waitForParent(PersistentObject *parent, uint64_t commit_id) {
+    RecoveryState *state = recovery_state;
+    pthread_mutex_lock(&state->lock);
+    wait_parent = parent;
+    wait_parent_commit_id = commit_id;
+    pthread_cond_broadcast(&state->parked);
+    pthread_mutex_unlock(&state->lock);
+}
+
+void PersistentObject::awaitParent(PersistentObject *parent) {
+    if (isWaitingForParent(parent)) return;
+    RecoveryPool *pool = RecoveryContext::getInstance().getPool();
+    if (pool != NULL) pool->beginBlocking();
+    RecoveryState *state = recovery_state;
+    pthread_mutex_lock(&state->lock);
+    while (!isWaitingForParent(parent)) {
+        pthread_cond_wait(&state->parked, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+    if (pool != NULL) pool->endBlocking();
+}
 
-        uint64_t getCommitId() const { return _commit_id; }
-        uint64_t getMethodTag() const { return _method_tag; }
-        char *getPtr() const { return _ptr; }
+/*
+ * The waiter count is raised before reading last_played_commit_id, and the
+ * recovery thread of this object reads it after updating the commit id, so
+ * that either the commit is seen here or the waiter is seen by wakeWaiters()
+ */
+bool PersistentObject::waitForCommit(uint64_t commit_id, PersistentObject *waiter) {
+    RecoveryState *state = recovery_state;
+    pthread_mutex_lock(&state->lock);
+    __sync_fetch_and_add(&state->waiter_count, 1);
+    if (last_played_commit_id >= commit_id) {
+        __sync_fetch_and_sub(&state->waiter_count, 1);
+        pthread_mutex_unlock(&state->lock);
+        return true;
+    }
+    state->waiters.push_back(make_pair(commit_id, waiter));
+    pthread_mutex_unlock(&state->lock);
+    return false;
+}
 
-    private:
-        char *_ptr;
-        uint64_t _commit_id;
-        uint64_t _method_tag;
-};
+void PersistentObject::wakeWaiters() {
+    RecoveryState *state = recovery_state;
+    __sync_synchronize();
+    if (state->waiter_count == 0) return;
 
-inline bool operator< (const CommitRecord& lhs, const CommitRecord& rhs) {
-    return lhs.getCommitId() > rhs.getCommitId(); // Force ASC order for priority queue
+    vector<PersistentObject *> ready;
+    pthread_mutex_lock(&state->lock);
+    auto it = state->waiters.begin();
+    while (it != state->waiters.end()) {
+        if (it->first <= last_played_commit_id) {
+            ready.push_back(it->second);
+            it = state->waiters.erase(it);
+        }
+        else ++it;
+    }
+    __sync_fetch_and_sub(&state->waiter_count, ready.size());
+    pthread_mutex_unlock(&state->lock);
+
+    RecoveryPool *pool = RecoveryContext::getInstance().getPool();
+    assert(pool != NULL || ready.empty());
+    for (auto r = ready.begin(); r != ready.end(); ++r) pool->resume(*r);
 }
 
 /*
  * [General rules]
  * NVM manager is responsible for recovering all persistent objects through calling their Recover()
- * method at startup. Each object is assigned to a recovery thread. Look for the constructor method of
- * NVManager for more details.
+ * method at startup. Objects are recovered by a pool of recovery threads (see RecoveryPool). Look for
+ * the constructor method of NVManager for more details.
  * Also, all allocations are handled by the NVM manager object, which either finds the object or creates
  * an new persistent object using the object's factory method.
  * ----------------------------------------------------------------------------------------------------
@@ -94,7 +145,9 @@ inline bool operator< (const CommitRecord& lhs, const CommitRecord& rhs) {
  * > Child (non-parent): once a child object reads a log entry that belongs to a nested transaction,
  *   it will wait for the parent object to pass the point specified in the nested transaction log entry.
  *   For example, if the parent log shows commit order 12, the child object waits for the parent to finish
- *   executing the corresponding log entry and update 'last_played_commit_order' to 12.
+ *   executing the corresponding log entry and update 'last_played_commit_order' to 12. Instead of
+ *   spinning, Recover() registers the child as a waiter of the parent commit and returns, and the
+ *   parent resumes the child once it has played that commit (see RecoveryGraph).
  * ----------------------------------------------------------------------------------------------------
  * [Partial commits]
  * These are committed log entries for nested transactions where the system fails before marking the
@@ -107,37 +160,33 @@ inline bool operator< (const CommitRecord& lhs, const CommitRecord& rhs) {
  * uncommitted transactions are not played.
  * ----------------------------------------------------------------------------------------------------
  */
-void PersistentObject::Recover() {
-    assert(log != NULL);
-    assert(sizeof(uint64_t) == 8); // We assume 2 * sizeof(uint64_t) == 16
-    NVManager *manager = RecoveryContext::getInstance().getManager();
-    assert(manager != NULL);
+/*
+ * [Partitioned recovery]
+ * Committed entries are collected and sorted by commit id, stopping at the
+ * first missing commit id (same entries as the sequential replay), and
+ * replayed by a group of threads (see PartitionReplay). The group borrows
+ * idle threads of the recovery pool, which recovers other objects.
+ */
+void PersistentObject::playPartition(void *object,
+        const PartitionRecord &record) {
+    ((PersistentObject *)object)->Play(record.method_tag,
+            (uint64_t *)record.ptr, false);
+}
 
-    // Calculating head and limit pointers
-    uint64_t logHead = RecoveryContext::getInstance().queryLogHeadOffset(uuid_str);
+bool PersistentObject::RecoverPartitioned() {
+    static_assert(AllPartitions == PartitionReplay::AllPartitions,
+            "partition of entries that must see all prior entries");
+    const size_t partitions = Partitions();
+    uint64_t logHead =
+        RecoveryContext::getInstance().queryLogHeadOffset(log_head_slot);
     if (logHead == 0) logHead = log->head;
     char *ptr = (char *)log + logHead;
     const char *limit = (char *)log + log->tail;
 
-    char uuid_str[64], uuid_prefix[9];
-    uuid_unparse(uuid, uuid_str);
-    memcpy(uuid_prefix, uuid_str, 8);
-    uuid_prefix[8] = '\0';
-    PRINT("[%s] Started recovering %s\n", uuid_prefix, uuid_str);
-    PRINT("[%s] Log head: %zu\n", uuid_prefix, log->head);
-    PRINT("[%s] New head: %zu\n", uuid_prefix, logHead);
-    PRINT("[%s] Log tail: %zu\n", uuid_prefix, log->tail);
-
-    // Creating data-structures to handle out-of-order entries
-    std::priority_queue<CommitRecord> commit_queue;
-
+    vector<PartitionRecord> records;
     while (ptr < limit) {
-        // 1. Read commit id and method tag from persistent log
         uint64_t commit_id = *((uint64_t *)ptr);
-        PRINT("[%s] Found record with commit order = %zu\n",
-                uuid_prefix, commit_id);
         ptr += sizeof(uint64_t);
-
         uint64_t magic = *((uint64_t *)ptr);
         if (commit_id == 0 && magic != REDO_LOG_MAGIC) { // partial transaction
             do {
@@ -145,33 +194,200 @@ void PersistentObject::Recover() {
                 magic = *((uint64_t *)ptr);
             } while (magic != REDO_LOG_MAGIC);
         }
-        // TODO bug fix: update commit_id when skipping partial transactions
-
         ptr += sizeof(uint64_t);
         assert(magic == REDO_LOG_MAGIC);
         uint64_t method_tag = *((uint64_t *)ptr);
         ptr += sizeof(uint64_t);
 
-        // 2. Add the entry to priority queue to sort entries based on commit id
         size_t bytes_processed = sizeof(uuid_t);
         if ((method_tag & NESTED_TX_TAG) == 0) { // dry run
             bytes_processed = Play(method_tag, (uint64_t *)ptr, true);
         }
+        if (commit_id > last_played_commit_id) {
+            // Nested transactions synchronize with other objects in commit order
+            if (method_tag & NESTED_TX_TAG) return false;
+            size_t partition = Partition(method_tag, (uint64_t *)ptr);
+            assert(partition == AllPartitions || partition < partitions);
+            PartitionRecord record = { commit_id, method_tag, ptr, partition };
+            records.push_back(record);
+        }
+        ptr += bytes_processed;
+        ptr += CACHE_LINE_WIDTH - ((24 + bytes_processed) % CACHE_LINE_WIDTH);
+    }
+
+    sort(records.begin(), records.end());
+    size_t count = 0;
+    while (count < records.size() &&
+            records[count].commit_id == last_played_commit_id + count + 1) {
+        count++;
+    }
+
+    size_t threads = Savitar_config()->recovery_threads;
+    if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = std::min(threads, partitions);
+    RecoveryPool *pool = RecoveryContext::getInstance().getPool();
+    size_t borrowed = 0;
+    if (pool != NULL && threads > 1) {
+        borrowed = pool->borrowThreads(threads - 1);
+        threads = borrowed + 1;
+    }
+    PRINT("[%s] Replaying %zu entries in %zu partitions using %zu threads\n",
+            uuid_str, count, partitions, threads);
+
+    PartitionReplay replay(records, count, threads, playPartition, this);
+    replay.run();
+    if (borrowed > 0) pool->returnThreads(borrowed);
+
+    last_played_commit_id += count;
+    wakeWaiters();
+    return true;
+}
+
+/*
+ * [Pipelined recovery]
+ * For large logs, the scanner thread parses the log (including dry runs of
+ * Play to find the size of each entry) and streams the records of entries
+ * to play to Recover() through a ring buffer, so that loading the log from
+ * memory overlaps with replaying entries. The scanner prefetches the log
+ * ahead of parsing with a non-temporal hint, as each line is read twice at
+ * most (dry run and replay) within a short window.
+ */
+void *PersistentObject::scanLog(void *arg) {
+    PersistentObject *object = (PersistentObject *)arg;
+    RecoveryState *state = object->recovery_state;
+    RecordRing *ring = state->ring;
+    char *ptr = state->ptr;
+    const char *limit = state->limit;
+    const char *prefetched = ptr;
+    const uint64_t last_played_commit_id = object->last_played_commit_id;
+
+    while (ptr < limit) {
+        while (prefetched < limit && prefetched < ptr + RECOVERY_PREFETCH_DISTANCE) {
+            __builtin_prefetch(prefetched, 0, 0);
+            prefetched += CACHE_LINE_WIDTH;
+        }
 
+        uint64_t commit_id = *((uint64_t *)ptr);
+        ptr += sizeof(uint64_t);
+        uint64_t magic = *((uint64_t *)ptr);
+        if (commit_id == 0 && magic != REDO_LOG_MAGIC) { // partial transaction
+            do {
+                ptr += CACHE_LINE_WIDTH;
+                magic = *((uint64_t *)ptr);
+            } while (magic != REDO_LOG_MAGIC);
+        }
+        ptr += sizeof(uint64_t);
+        assert(magic == REDO_LOG_MAGIC);
+        uint64_t method_tag = *((uint64_t *)ptr);
+        ptr += sizeof(uint64_t);
+
+        size_t bytes_processed = sizeof(uuid_t);
+        if ((method_tag & NESTED_TX_TAG) == 0) { // dry run
+            bytes_processed = object->Play(method_tag, (uint64_t *)ptr, true);
+        }
         if (commit_id > last_played_commit_id) {
-            commit_queue.push(CommitRecord(ptr, commit_id, method_tag));
+            ScanRecord record = { ptr, commit_id, method_tag };
+            ring->push(record);
         }
 
-        // 3. Update iterator to point to the next entry
         ptr += bytes_processed;
         ptr += CACHE_LINE_WIDTH - ((24 + bytes_processed) % CACHE_LINE_WIDTH);
+    }
+    ring->close();
+    return NULL;
+}
+
+// Plays a run of in-order entries (see ReplayBatchSize)
+void PersistentObject::playBatch(vector<ReplayEntry> &batch) {
+    PlayBatch(batch.data(), batch.size());
+    last_played_commit_id += batch.size();
+    batch.clear();
+    wakeWaiters();
+}
+
+bool PersistentObject::Recover() {
+    assert(log != NULL);
+    assert(sizeof(uint64_t) == 8); // We assume 2 * sizeof(uint64_t) == 16
+    NVManager *manager = RecoveryContext::getInstance().getManager();
+    assert(manager != NULL);
+
+    char uuid_str[64], uuid_prefix[9];
+    uuid_unparse(uuid, uuid_str);
+    memcpy(uuid_prefix, uuid_str, 8);
+    uuid_prefix[8] = '\0';
+
+    /*
+     * Objects can be resumed (see wakeWaiters) before the thread suspending
+     * them has returned from Recover(), which takes a few instructions
+     */
+    assert(recovery_state != NULL);
+    while (!__sync_bool_compare_and_swap(&recovery_state->running, 0, 1)) {
+        sched_yield();
+    }
+    const uint64_t replay_start = RecoveryReport::now();
+    if (recovery_state->suspended_at != 0) {
+        recovery_state->blocked_ns += replay_start - recovery_state->suspended_at;
+        recovery_state->suspended_at = 0;
+    }
 
-        // 4. Use the priority queue to play entries in order
-        while (!commit_queue.empty() &&
-                commit_queue.top().getCommitId() == last_played_commit_id + 1) {
+    if (!recovery_state->started) {
+        recovery_state->started = true;
+        if (Partitions() > 1 && RecoverPartitioned()) {
+            PRINT("[%s] Finished recovering %s (partitioned)\n", uuid_prefix, uuid_str);
+            recovery_state->replay_ns += RecoveryReport::now() - replay_start;
+            recovery_state->running = 0;
+            return true;
+        }
+
+        // Calculating head and limit pointers
+        uint64_t logHead =
+            RecoveryContext::getInstance().queryLogHeadOffset(log_head_slot);
+        if (logHead == 0) logHead = log->head;
+        recovery_state->ptr = (char *)log + logHead;
+        recovery_state->limit = (char *)log + log->tail;
+
+        PRINT("[%s] Started recovering %s\n", uuid_prefix, uuid_str);
+        PRINT("[%s] Log head: %zu\n", uuid_prefix, log->head);
+        PRINT("[%s] New head: %zu\n", uuid_prefix, logHead);
+        PRINT("[%s] Log tail: %zu\n", uuid_prefix, log->tail);
+
+        const uint64_t pipeline_bytes = Savitar_config()->recovery_pipeline_bytes;
+        if (pipeline_bytes > 0 && log->tail - logHead >= pipeline_bytes) {
+            PRINT("[%s] Scanning the log on a separate thread\n", uuid_prefix);
+            recovery_state->ring = new RecordRing(RECOVERY_RING_SIZE);
+            assert(pthread_create(&recovery_state->scanner, NULL, scanLog,
+                        this) == 0);
+        }
+    }
+    else {
+        PRINT("[%s] Resumed recovering %s\n", uuid_prefix, uuid_str);
+    }
+    char *ptr = recovery_state->ptr;
+    const char *limit = recovery_state->limit;
+    std::priority_queue<CommitRecord> &commit_queue = recovery_state->commit_queue;
+    const size_t batch_size = ReplayBatchSize();
+    vector<ReplayEntry> batch;
+    batch.reserve(batch_size);
+
+    while (true) {
+        // 1. Use the priority queue to play entries in order
+        while (!commit_queue.empty() && commit_queue.top().getCommitId() ==
+                last_played_commit_id + batch.size() + 1) {
             const CommitRecord &record = commit_queue.top();
             PRINT("[%s] Playing record with commit order = %zu\n",
                     uuid_prefix, record.getCommitId());
+            if (batch_size > 1 && (record.getMethodTag() & NESTED_TX_TAG) == 0) {
+                ReplayEntry entry = { record.getMethodTag(),
+                    (uint64_t *)record.getPtr() };
+                batch.push_back(entry);
+                commit_queue.pop();
+                if (batch.size() == batch_size) playBatch(batch);
+                continue;
+            }
+            if (!batch.empty()) {
+                playBatch(batch);
+                continue; // record is still at the top
+            }
             if (record.getMethodTag() & NESTED_TX_TAG) { // dependant (nested) transaction
                 off_t parent_offset = (off_t)(record.getMethodTag() & (~NESTED_TX_TAG));
                 PRINT("[%s] Nested transaction, parent entry at offset %zu\n",
@@ -183,13 +399,29 @@ void PersistentObject::Recover() {
                 uuid_unparse(parent_uuid->uuid, parent_uuid_str);
                 PersistentObject *parent = manager->findObject(parent_uuid_str);
                 assert(parent != NULL);
+                // Snapshots are quiescent, so the parent log has entries past
+                // its snapshot tail and is mapped (see NVManager::reopenObject)
+                assert(parent->log != NULL);
                 uint64_t expected_commit_id = *((uint64_t *)((char *)parent->log +
                             parent_offset));
                 PRINT("[%s] Nested transaction, waiting for object %s to execute commit %zu\n",
                         uuid_prefix, parent_uuid_str, expected_commit_id);
+                vector<RecoveryEdge> &edges = recovery_state->edges;
+                if (edges.empty() || edges.back().commit_id != record.getCommitId()) {
+                    RecoveryEdge edge = { record.getCommitId(), parent,
+                        expected_commit_id };
+                    edges.push_back(edge);
+                }
                 waitForParent(parent, expected_commit_id);
-                while (parent->last_played_commit_id < expected_commit_id) {
+                if (!parent->waitForCommit(expected_commit_id, this)) {
+                    // Suspend until the parent has played our entry
                     assert(parent->isRecovering());
+                    recovery_state->ptr = ptr;
+                    recovery_state->suspended_at = RecoveryReport::now();
+                    recovery_state->replay_ns +=
+                        recovery_state->suspended_at - replay_start;
+                    recovery_state->running = 0;
+                    return false;
                 }
                 PRINT("[%s] Done waiting for parent object\n", uuid_prefix);
             }
@@ -200,9 +432,66 @@ void PersistentObject::Recover() {
             PRINT("[%s] Finished playing commit order %zu, last played commit updated to %zu\n",
                     uuid_prefix, record.getCommitId(), last_played_commit_id);
             commit_queue.pop();
+            wakeWaiters();
         }
+
+        if (recovery_state->ring != NULL) { // pipelined
+            ScanRecord record;
+            if (!recovery_state->ring->pop(&record)) {
+                pthread_join(recovery_state->scanner, NULL);
+                delete recovery_state->ring;
+                recovery_state->ring = NULL;
+                if (!batch.empty()) playBatch(batch);
+                break;
+            }
+            commit_queue.push(CommitRecord(record.ptr, record.commit_id,
+                        record.method_tag));
+            continue;
+        }
+
+        if (ptr >= limit) {
+            if (!batch.empty()) playBatch(batch);
+            break;
+        }
+
+        // 2. Read commit id and method tag from persistent log
+        uint64_t commit_id = *((uint64_t *)ptr);
+        PRINT("[%s] Found record with commit order = %zu\n",
+                uuid_prefix, commit_id);
+        ptr += sizeof(uint64_t);
+
+        uint64_t magic = *((uint64_t *)ptr);
+        if (commit_id == 0 && magic != REDO_LOG_MAGIC) { // partial transaction
+            do {
+                ptr += CACHE_LINE_WIDTH;
+                magic = *((uint64_t *)ptr);
+            } while (magic != REDO_LOG_MAGIC);
+        }
+        // TODO bug fix: update commit_id when skipping partial transactions
+
+        ptr += sizeof(uint64_t);
+        assert(magic == REDO_LOG_MAGIC);
+        uint64_t method_tag = *((uint64_t *)ptr);
+        ptr += sizeof(uint64_t);
+
+        // 3. Add the entry to priority queue to sort entries based on commit id
+        size_t bytes_processed = sizeof(uuid_t);
+        if ((method_tag & NESTED_TX_TAG) == 0) { // dry run
+            bytes_processed = Play(method_tag, (uint64_t *)ptr, true);
+        }
+
+        if (commit_id > last_played_commit_id) {
+            commit_queue.push(CommitRecord(ptr, commit_id, method_tag));
+        }
+
+        // 4. Update iterator to point to the next entry
+        ptr += bytes_processed;
+        ptr += CACHE_LINE_WIDTH - ((24 + bytes_processed) % CACHE_LINE_WIDTH);
     }
 
-    assert(commit_queue.empty());
+    assert(commit_queue.empty() && batch.empty());
+    recovery_state->replay_ns += RecoveryReport::now() - replay_start;
+    recovery_state->running = 0;
     PRINT("[%s] Finished recovering %s\n", uuid_prefix, uuid_str);
+    return true;
 }
@@ -4,12 +4,16 @@
 #include <assert.h>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 #include "nv_log.hpp"
 #include "nvm_manager.hpp"
 #include "ckpt_alloc.hpp"
+#include "config.hpp"
 
 class NVManager;
 class Snapshot;
+struct RecoveryState;
+struct PartitionRecord;
 
 /*
  * Objects demanding transactional durability must extend this class and
@@ -36,8 +40,17 @@ class PersistentObject {
             return (unsigned char *)uuid;
         }
 
+        // Durability barrier support (see Savitar_log_barrier)
+        uint64_t beginOperation() { return Savitar_log_begin_op(control); }
+        void endOperation(uint64_t epoch) { Savitar_log_end_op(control, epoch); }
+        void barrier() { Savitar_log_barrier(control); }
+
         bool isRecovering() { return recovering != 0; }
-        bool isWaitingForSnapshot() { return log->snapshot_lock != 0; }
+        LogControl *getControl() const { return control; }
+
+        // Volatile, assigned every time the object is created or recovered
+        QosClass getQosClass() const { return (QosClass)control->qos_class; }
+        void setQosClass(QosClass qos_class) { control->qos_class = qos_class; }
 
         ObjectAlloc *getAllocator() { return alloc; }
 
@@ -60,10 +73,21 @@ class PersistentObject {
          */
         PersistentObject *wait_parent = NULL;
         uint64_t wait_parent_commit_id = 0;
-        void waitForParent(PersistentObject *parent, uint64_t commit_id) {
-            wait_parent = parent;
-            wait_parent_commit_id = commit_id;
-        }
+        void waitForParent(PersistentObject *parent, uint64_t commit_id);
+
+        /*
+         * Dependency tracking between recovering objects (no busy waiting)
+         * waitForCommit: returns true if the commit is already played, or
+         * registers the waiter, which is resumed by wakeWaiters() later on
+         */
+        RecoveryState *recovery_state = NULL;
+        bool waitForCommit(uint64_t commit_id, PersistentObject *waiter);
+        void wakeWaiters();
+
+        // Returns false if the log can not be replayed in partitions
+        bool RecoverPartitioned();
+        static void playPartition(void *, const PartitionRecord &);
+        static void *scanLog(void *);
 
         void constructor(uuid_t id);
 
@@ -81,13 +105,58 @@ class PersistentObject {
             return true;
         }
 
+        // Blocks the recovery thread of the parent until the above holds
+        void awaitParent(PersistentObject *parent);
+
     protected:
-        // Called by NVM Manager during the recovery process
-        void Recover();
+        /*
+         * Called by NVM Manager during the recovery process
+         * Returns false if recovery is suspended waiting for a parent object
+         * (nested transaction), in which case it must be called again later.
+         */
+        bool Recover();
 
         // Called by the NVM Manager through Recover()
         virtual size_t Play(uint64_t tag, uint64_t *args, bool dry) = 0;
 
+        /*
+         * Partitioned replay (optional)
+         * Objects whose operations commute across partitions (e.g., buckets
+         * of a hash map) can return more than one partition, so that Recover()
+         * replays partitions in parallel, in commit order within a partition.
+         * Partition() maps a log entry (same arguments as Play) to a partition,
+         * or to AllPartitions for operations that must see all prior entries.
+         * Partitioned operations must be safe to run concurrently with other
+         * partitions and must not call other persistent objects.
+         */
+        static const size_t AllPartitions = (size_t)-1;
+        virtual size_t Partitions() { return 1; }
+        virtual size_t Partition(uint64_t tag, uint64_t *args) {
+            return AllPartitions;
+        }
+
+        /*
+         * Batched replay (optional)
+         * Objects that can apply consecutive entries faster in bulk (e.g.,
+         * by reserving capacity or sorting keys) return a batch size larger
+         * than one, so that Recover() passes runs of in-order committed
+         * entries to PlayBatch() instead of calling Play() for each entry.
+         * Batched operations must not call other persistent objects (nested
+         * transactions), as other objects only see the commit id of the last
+         * entry of a batch once the whole batch is played.
+         */
+        typedef struct ReplayEntry {
+            uint64_t tag;
+            uint64_t *args;
+        } ReplayEntry;
+        virtual size_t ReplayBatchSize() { return 1; }
+        virtual void PlayBatch(const ReplayEntry *entries, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                Play(entries[i].tag, entries[i].args, false);
+            }
+        }
+        void playBatch(vector<ReplayEntry> &);
+
         /*
          * Constructor arguments buffer
          * Filled by the constructor method of child objects.
@@ -115,6 +184,16 @@ class PersistentObject {
         uint64_t last_played_commit_id;
         ObjectAlloc *alloc = NULL;
 
+        // Volatile state of the semantic log (not part of snapshots)
+        LogControl *control = NULL;
+
+        // Log head slot in RecoveryContext (set by Snapshot::load)
+        uint32_t log_head_slot = (uint32_t)-1;
+
+        // Log tail when the last snapshot was taken (see pendingLogBytes)
+        uint64_t snapshot_tail = 0;
+
         friend class NVManager;
         friend class Snapshot;
+        friend class RecoveryGraph;
 };
@@ -1,4 +1,5 @@
 #include <pthread.h>
+#include <unistd.h>
 #include <list>
 #include <queue>
 #include "nv_factory.hpp"
@@ -6,7 +7,12 @@
 #include "nvm_manager.hpp"
 #include "nv_catalog.hpp"
 #include "recovery_context.hpp"
+#include "recovery_graph.hpp"
+#include "recovery_pool.hpp"
 #include "snapshot.hpp"
+#include "snapshot_restore.hpp"
+#include "ckpt_alloc.hpp"
+#include "recovery_report.hpp"
 
 using namespace std;
 
@@ -15,85 +21,262 @@ NVManager::NVManager() {
     pthread_mutex_init(&_lock, NULL);
     pthread_mutex_init(&_ckptLock, NULL);
     pthread_cond_init(&_ckptCondition, NULL);
+    pthread_mutex_init(&_recoveryLock, NULL);
+    pthread_cond_init(&_recoveryCondition, NULL);
 
     /*
      * Reading catalog from NVM -- this will populate ex_objects
      * The catalog contains the superset of objects in any snapshot
      */
+    RecoveryReport &report = RecoveryReport::getInstance();
+    uint64_t phase_start = RecoveryReport::now();
+    const uint64_t prologue_start = phase_start;
     list< pair<std::string, CatalogEntry *> > ex_objects;
     catalog = new NVCatalog(CATALOG_FILE_NAME, ex_objects);
     PRINT("Finished creating/opening persistent catalog.\n");
+
+    /*
+     * Warm restart: the heap file of a clean shutdown is still valid, so
+     * there are no pages to restore and no log entries to replay
+     */
+    bool warm = false;
+    const char *warm_heap = Savitar_config()->warm_heap;
+    if (warm_heap != NULL) {
+        Snapshot *snapshot = new Snapshot(PMEM_PATH);
+        uuid_t generation;
+        size_t heap_size = 0;
+        warm = (catalog->getFlags() & CatalogFlagCleanShutdown) != 0 &&
+            ex_objects.size() > 0 &&
+            snapshot->hasWarmState(ex_objects.size(), generation, &heap_size);
+        // Falls back to a cold start unless the heap file is the one saved
+        warm = GlobalAlloc::openHeapFile(warm_heap, warm ? generation : NULL,
+                heap_size);
+        if (!warm) snapshot->dropWarmState(); // dropped by loadWarm otherwise
+        delete snapshot;
+    }
     if (ex_objects.size() == 0) return;
 
     // Prepare for recovery
     RecoveryContext::getInstance().setManager(this);
-    struct timespec t1, t2;
-    clock_gettime(CLOCK_REALTIME, &t1);
+    clock_gettime(CLOCK_REALTIME, &recovery_start);
+    report.addPhase(PhaseCatalogOpen, RecoveryReport::now() - phase_start);
+    report.beginPart(); // replay (see finishRecovery)
 
-    // Load the latest snapshot (if any)
+    // Load the warm state or the latest snapshot (if any)
     Snapshot *snapshot = new Snapshot(PMEM_PATH);
-    if (snapshot->lastSnapshotID() > 0) {
-        snapshot->load(snapshot->lastSnapshotID(), this);
+    if (warm) {
+        snapshot->loadWarm(this);
+    }
+    else if (snapshot->lastCompleteSnapshotID() > 0) {
+        snapshot->load(snapshot->lastCompleteSnapshotID(), this);
     }
     delete snapshot;
 
-    // Prepare environment for recovery (populate objects from ex_objects)
-    for (auto it = ex_objects.begin(); it != ex_objects.end(); ++it) {
-        recoverObject(it->first.c_str(), it->second);
-    }
+    /*
+     * Prepare environment for recovery (populate objects from ex_objects)
+     * Logs are only needed before replay for crash fixup (unclean shutdown)
+     */
+    uint64_t cflags = catalog->getFlags();
+    phase_start = RecoveryReport::now();
+    uint64_t deferred_logs = recoverObjects(ex_objects,
+            (cflags & CatalogFlagCleanShutdown) != 0);
     ex_objects.clear();
-    const size_t obj_count = objects.size();
+    report.addPhase(PhaseObjectOpen, RecoveryReport::now() - phase_start);
 
     /*
      * Handling unclean shutdowns
      * We provide support for transaction aborts here. The effect of an aborted
      * transaction on other objects/transactions is implemented here.
      */
-    uint64_t cflags = catalog->getFlags();
+    report.setCleanShutdown((cflags & CatalogFlagCleanShutdown) != 0);
     if ((cflags & CatalogFlagCleanShutdown) == 0) {
         PRINT("Manager: detected unclean shutdown, fixing redo-logs ...\n");
+        phase_start = RecoveryReport::now();
         int aborted_transactions = emulateRecoveryAndFixRedoLogs();
+        report.addPhase(PhaseLogFixup, RecoveryReport::now() - phase_start);
         PRINT("Manager: finished fixing redo-logs, total aborted transactions = %d\n",
                 aborted_transactions);
     }
 
     /*
-     * Creating recovery threads (one per persistent object)
-     * We assume number of persistent objects are not much larger than
-     * the number of CPU cores.
-     * If that is not the case, we should partition persistent objects to
-     * groups with no inter-class dependencies and recover partitions
-     * one at a time.
+     * Recovering persistent objects using a pool of recovery threads
+     * (one per core by default), largest logs first
      */
     PRINT("Manager: recovering persistent objects ...\n");
-    size_t counter = 0;
-    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * obj_count);
-    for (auto it = objects.begin(); it != objects.end(); ++it) {
-        assert(counter < obj_count);
-        pthread_create(&threads[counter++], NULL, recoveryWorker, it->second);
+    size_t pool_size = Savitar_config()->recovery_threads;
+    if (pool_size == 0) pool_size = sysconf(_SC_NPROCESSORS_ONLN);
+    recovery_pool = new RecoveryPool(pool_size, recoveryStep);
+    recovery_graph = new RecoveryGraph();
+    recovering_objects = objects;
+    for (auto it = recovering_objects.begin(); it != recovering_objects.end();
+            ++it) {
+        PersistentObject *object = it->second;
+        uint64_t log_bytes = 0; // deferred logs have nothing to replay
+        if (object->log != NULL) {
+            uint64_t head = RecoveryContext::getInstance().queryLogHeadOffset(
+                    object->log_head_slot);
+            if (head == 0) head = object->log->head;
+            log_bytes = object->log->tail - head;
+        }
+        recovery_pool->add(object, log_bytes);
+        recovery_graph->addObject(object);
+        object->recovery_state->log_bytes = log_bytes;
     }
-
-    // Wait for recovery threads to return
-    for (size_t i = 0; i < obj_count; i++) {
-        pthread_join(threads[i], NULL);
+    RecoveryContext::getInstance().setPool(recovery_pool);
+    replay_start = RecoveryReport::now();
+    report.setPrologue(replay_start - prologue_start, deferred_logs);
+    fprintf(stdout, "Prologue Time (ms)\t%.2f\n",
+            (double)(replay_start - prologue_start) / 1E6);
+    recovery_pool->start();
+
+    if (Savitar_config()->recovery_mode == RecoveryLazy) {
+        // Logs are modified before recovery is complete
+        markUncleanShutdown();
+        background_recovery = true;
+        pthread_create(&recovery_thread, NULL, backgroundRecovery, this);
+
+        struct timespec t2;
+        clock_gettime(CLOCK_REALTIME, &t2);
+        uint64_t startupTime = (t2.tv_sec - recovery_start.tv_sec) * 1E9;
+        startupTime += (t2.tv_nsec - recovery_start.tv_nsec);
+        fprintf(stdout, "Startup Time (ms)\t%.2f\n", (double)startupTime / 1E6);
+        report.setStartupTime(startupTime);
+        return;
     }
 
-    // Cleanup environment
-    clock_gettime(CLOCK_REALTIME, &t2);
-    PRINT("Manager: finished recovering persistent objects!\n");
-    free(threads);
+    finishRecovery();
+    markUncleanShutdown();
+}
 
+void NVManager::markUncleanShutdown() {
     PRINT("Manager: updating catalog flags.\n");
-    cflags = catalog->getFlags();
+    uint64_t cflags = catalog->getFlags();
     cflags = (cflags & (~CatalogFlagCleanShutdown)); // unclean shutdown
     catalog->setFlags(cflags);
+}
+
+void NVManager::finishRecovery() {
+    recovery_pool->wait();
+    RecoveryReport &report = RecoveryReport::getInstance();
+    report.addPhase(PhaseReplay, RecoveryReport::now() - replay_start);
+    pthread_mutex_lock(&_recoveryLock);
+    RecoveryContext::getInstance().setPool(NULL);
+    delete recovery_pool;
+    recovery_pool = NULL;
+    pthread_mutex_unlock(&_recoveryLock);
+
+    // Only reported in presence of nested transactions
+    uint64_t critical_path, replayed_entries;
+    if (recovery_graph->criticalPath(&critical_path, &replayed_entries)) {
+        fprintf(stdout, "Recovery Critical Path (entries)\t%zu\t%zu\n",
+                critical_path, replayed_entries);
+    }
+    for (auto it = recovering_objects.begin(); it != recovering_objects.end();
+            ++it) {
+        PersistentObject *object = it->second;
+        RecoveryState *state = object->recovery_state;
+        ObjectRecoveryReport stats = { it->first, state->log_bytes,
+            object->last_played_commit_id - state->first_commit_id,
+            state->replay_ns, state->blocked_ns };
+        report.addObject(stats);
+    }
+    recovery_graph->clear();
+    delete recovery_graph;
+    recovery_graph = NULL;
+    recovering_objects.clear();
 
-    uint64_t recoveryTime = (t2.tv_sec - t1.tv_sec) * 1E9;
-    recoveryTime += (t2.tv_nsec - t1.tv_nsec);
+    // Cleanup environment
+    struct timespec t2;
+    clock_gettime(CLOCK_REALTIME, &t2);
+    PRINT("Manager: finished recovering persistent objects!\n");
+
+    uint64_t recoveryTime = (t2.tv_sec - recovery_start.tv_sec) * 1E9;
+    recoveryTime += (t2.tv_nsec - recovery_start.tv_nsec);
     fprintf(stdout, "Recovery Time (ms)\t%.2f\n", (double)recoveryTime / 1E6);
+    report.setRecoveryTime(recoveryTime);
+    if (!background_recovery) report.setStartupTime(recoveryTime);
+    report.endPart();
+}
+
+void *NVManager::backgroundRecovery(void *arg) {
+    NVManager *manager = (NVManager *)arg;
+    manager->finishRecovery();
+    pthread_mutex_lock(&manager->_recoveryLock);
+    manager->background_recovery = false;
+    pthread_cond_broadcast(&manager->_recoveryCondition);
+    pthread_mutex_unlock(&manager->_recoveryLock);
+    return NULL;
+}
+
+void NVManager::waitForRecovery() {
+    pthread_mutex_lock(&_recoveryLock);
+    while (background_recovery) {
+        pthread_cond_wait(&_recoveryCondition, &_recoveryLock);
+    }
+    pthread_mutex_unlock(&_recoveryLock);
+    SnapshotRestore::wait(); // on-demand snapshot pages
+}
+
+void NVManager::waitForObject(PersistentObject *object) {
+    if (!object->isRecovering()) return;
+    pthread_mutex_lock(&_recoveryLock);
+    if (recovery_pool != NULL) recovery_pool->prioritize(object);
+    while (object->isRecovering()) {
+        pthread_cond_wait(&_recoveryCondition, &_recoveryLock);
+    }
+    pthread_mutex_unlock(&_recoveryLock);
+}
+
+void NVManager::shutdownCheckpoint() {
+    waitForRecovery();
+    if (objects.empty()) return;
+
+    uint64_t start = RecoveryReport::now();
+    Snapshot *snapshot = new Snapshot(PMEM_PATH);
+    snapshot->create();
+    uint64_t snapshot_ns = RecoveryReport::now() - start;
+
+    /*
+     * Logs are truncated once the snapshot is complete, as objects that are
+     * not part of an older snapshot are replayed from the log head
+     */
+    uint64_t truncate_start = RecoveryReport::now();
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        Savitar_log_truncate(it->second->log);
+    }
+    uint64_t truncate_ns = RecoveryReport::now() - truncate_start;
+    snapshot->collectExpired();
+    delete snapshot;
+
+    fprintf(stdout, "Shutdown Time (ms: snapshot/truncate/total)\t%.2f\t%.2f\t%.2f\n",
+            (double)snapshot_ns / 1E6, (double)truncate_ns / 1E6,
+            (double)(RecoveryReport::now() - start) / 1E6);
+}
+
+void NVManager::saveWarmState() {
+    waitForRecovery();
+    Snapshot *snapshot = new Snapshot(PMEM_PATH);
+    snapshot->saveWarmState();
+    delete snapshot;
+}
+
+void NVManager::pendingLogBytes(uint64_t *total, uint64_t *largest) {
+    *total = 0;
+    *largest = 0;
+    lock();
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        PersistentObject *object = it->second;
+        if (object->log == NULL) continue; // deferred (nothing to replay)
+        uint64_t head = std::max(object->log->head, object->snapshot_tail);
+        uint64_t bytes = object->log->tail - std::min(head, object->log->tail);
+        *total += bytes;
+        *largest = std::max(*largest, bytes);
+    }
+    unlock();
 }
 
 NVManager::~NVManager() {
+    waitForRecovery();
     PRINT("Manager: updating catalog flags before terminating.\n");
     uint64_t cflags = catalog->getFlags();
     cflags = cflags | CatalogFlagCleanShutdown;
@@ -103,13 +286,15 @@ NVManager::~NVManager() {
     pthread_mutex_destroy(&_lock);
     pthread_mutex_destroy(&_ckptLock);
     pthread_cond_destroy(&_ckptCondition);
+    pthread_mutex_destroy(&_recoveryLock);
+    pthread_cond_destroy(&_recoveryCondition);
     PRINT("Destroyed manager object\n");
 #ifdef DEBUG
     GlobalAlloc::getInstance()->report();
 #endif
 }
 
-PersistentObject *NVManager::findRecovered(uuid_t uuid) {
+PersistentObject *NVManager::findRecovered(uuid_t uuid, QosClass qos_class) {
     char uuid_str[64];
     uuid_unparse(uuid, uuid_str);
     auto it = objects.find(uuid_str);
@@ -117,10 +302,13 @@ PersistentObject *NVManager::findRecovered(uuid_t uuid) {
     PersistentObject *object = it->second;
     assert(!object->assigned);
     object->assigned = true;
+    object->setQosClass(qos_class);
     return object;
 }
 
-void NVManager::createNew(uint64_t type_id, PersistentObject *object) {
+void NVManager::createNew(uint64_t type_id, PersistentObject *object,
+        QosClass qos_class) {
+    object->setQosClass(qos_class);
     CatalogEntry *entry = catalog->add(object->getUUID(), type_id);
     if (object->const_args != NULL) {
         catalog->addConstructorArgs(entry, object->const_args,
@@ -137,41 +325,143 @@ void NVManager::destroy(PersistentObject *object) {
     object->assigned = false;
 }
 
-void NVManager::recoverObject(const char *uuid_str, CatalogEntry *object) {
-    if (objects.find(uuid_str) != objects.end()) { // Recover from snapshot
-        PRINT("Recovering object from snapshot, uuid = %s\n", uuid_str);
-        PersistentObject *pobj = objects.find(uuid_str)->second;
-        assert(pobj != NULL);
-        PersistentFactory::vTableUpdate(object->type, pobj);
-        PRINT("Updated vTable to %p for persistent object, uuid = %s\n",
-                (void*)(((uintptr_t*)pobj)[0]), uuid_str);
-        pobj->recovering = true;
-        pobj->log = Savitar_log_open(pobj->uuid);
-        pobj->alloc = GlobalAlloc::getInstance()->findAllocator(pobj->uuid);
-        pobj->assigned = false;
+typedef struct {
+    pthread_t thread;
+    NVManager *instance;
+    vector< pair<PersistentObject *, CatalogEntry *> > *objects;
+    volatile uint64_t *next_object;
+    bool defer_logs;
+    uint64_t deferred_logs;
+} ObjectOpenerArg;
+
+/*
+ * Objects restored from a snapshot only need their logs and volatile state,
+ * which is independent across objects (no inserts into the object map)
+ * Other objects are constructed by their factory methods, one by one.
+ * Returns the number of logs that are not mapped yet (see reopenObject).
+ */
+uint64_t NVManager::recoverObjects(list< pair<string, CatalogEntry *> > &ex_objects,
+        bool defer_logs) {
+    const size_t ObjectsPerOpener = 64;
+    vector< pair<PersistentObject *, CatalogEntry *> > snapshot_objects;
+    for (auto it = ex_objects.begin(); it != ex_objects.end(); ++it) {
+        auto found = objects.find(it->first);
+        if (found != objects.end()) {
+            snapshot_objects.push_back(pair<PersistentObject *, CatalogEntry *>(
+                        found->second, it->second));
+        }
+        else {
+            recoverObject(it->first.c_str(), it->second);
+        }
+    }
+
+    size_t opener_count = Savitar_config()->recovery_threads;
+    if (opener_count == 0) opener_count = sysconf(_SC_NPROCESSORS_ONLN);
+    opener_count = min(opener_count,
+            (snapshot_objects.size() + ObjectsPerOpener - 1) / ObjectsPerOpener);
+    if (opener_count == 0) return 0;
+
+    volatile uint64_t next_object = 0;
+    ObjectOpenerArg *openers = (ObjectOpenerArg *)malloc(opener_count *
+            sizeof(ObjectOpenerArg));
+    for (size_t i = 0; i < opener_count; i++) {
+        openers[i].instance = this;
+        openers[i].objects = &snapshot_objects;
+        openers[i].next_object = &next_object;
+        openers[i].defer_logs = defer_logs;
+        openers[i].deferred_logs = 0;
+        pthread_create(&openers[i].thread, NULL, openObjects, &openers[i]);
     }
-    else {
-        PRINT("Adding object to recovery queue, uuid = %s\n", uuid_str);
-        PersistentObject *pobj = PersistentFactory::create(this,
-                object->type, object);
-        assert(pobj != NULL);
-        pobj->recovering = true;
-        pobj->last_played_commit_id = 0;
-        objects.insert(pair<string, PersistentObject *>(uuid_str, pobj));
+
+    uint64_t deferred_logs = 0;
+    for (size_t i = 0; i < opener_count; i++) {
+        pthread_join(openers[i].thread, NULL);
+        deferred_logs += openers[i].deferred_logs;
     }
+    free(openers);
+    PRINT("Manager: opened %zu objects from snapshot with %zu threads, "
+            "%zu logs deferred\n", snapshot_objects.size(), opener_count,
+            deferred_logs);
+    return deferred_logs;
 }
 
-void *NVManager::recoveryWorker(void *arg) {
-    PersistentObject *object = (PersistentObject *)arg;
-    object->Recover();
+void *NVManager::openObjects(void *arg) {
+    ObjectOpenerArg *opener = (ObjectOpenerArg *)arg;
+    vector< pair<PersistentObject *, CatalogEntry *> > &objects =
+        *opener->objects;
+    while (true) {
+        uint64_t i = __sync_fetch_and_add(opener->next_object, 1);
+        if (i >= objects.size()) break;
+        if (!opener->instance->reopenObject(objects[i].first,
+                    objects[i].second, opener->defer_logs)) {
+            opener->deferred_logs++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Recover from snapshot, returns false if mapping the log is deferred
+ * A log that has no entries past the tail saved with the snapshot is mapped
+ * by the recovery thread of the object (recoveryStep), off the prologue.
+ */
+bool NVManager::reopenObject(PersistentObject *pobj, CatalogEntry *object,
+        bool defer_log) {
+    PRINT("Recovering object from snapshot, uuid = %s\n", pobj->uuid_str);
+    PersistentFactory::vTableUpdate(object->type, pobj);
+    PRINT("Updated vTable to %p for persistent object, uuid = %s\n",
+            (void*)(((uintptr_t*)pobj)[0]), pobj->uuid_str);
+    pobj->recovering = true;
+    if (defer_log) {
+        SavitarLog header;
+        uint64_t tail = RecoveryContext::getInstance().queryLogHeadOffset(
+                pobj->log_head_slot);
+        defer_log = tail != 0 && Savitar_log_read_header(pobj->uuid, &header) &&
+            header.tail == tail;
+    }
+    pobj->log = defer_log ? NULL : Savitar_log_open(pobj->uuid);
+    pobj->control = Savitar_log_control_create();
+    pobj->recovery_state = NULL;
+    pobj->alloc = GlobalAlloc::getInstance()->findAllocator(pobj->uuid);
+    pobj->assigned = false;
+    return !defer_log;
+}
+
+void NVManager::recoverObject(const char *uuid_str, CatalogEntry *object) {
+    PRINT("Adding object to recovery queue, uuid = %s\n", uuid_str);
+    PersistentObject *pobj = PersistentFactory::create(this,
+            object->type, object);
+    assert(pobj != NULL);
+    pobj->recovering = true;
+    pobj->last_played_commit_id = 0;
+    pobj->log_head_slot = RecoveryContext::NoSlot;
+    objects.insert(pair<string, PersistentObject *>(uuid_str, pobj));
+}
+
+bool NVManager::recoveryStep(PersistentObject *object) {
+    // Restore the pages of the object before replaying its log (lazy restore)
+    if (!object->recovery_state->started) {
+        SnapshotRestore::restoreObject(object->alloc);
+        if (object->log == NULL) object->log = Savitar_log_open(object->uuid);
+    }
+    if (!object->Recover()) return false;
+    object->control->last_commit = object->last_played_commit_id;
+    // The log was checked (crash fixup) and replayed up to its tail
+    Savitar_log_watermark(object->log, object->last_played_commit_id,
+            object->log->tail);
+    NVManager *manager = RecoveryContext::getInstance().getManager();
+    pthread_mutex_lock(&manager->_recoveryLock);
     object->recovering = false;
+    pthread_cond_broadcast(&manager->_recoveryCondition);
+    pthread_mutex_unlock(&manager->_recoveryLock);
+    return true;
 }
 
 PersistentObject *NVManager::findObject(string uuid_str) {
-    auto it = objects.find(uuid_str);
-    if (it == objects.end()) {
+    auto it = recovering_objects.find(uuid_str);
+    if (it == recovering_objects.end()) {
         PRINT("Unable to find object with uuid = %s\n", uuid_str.c_str());
-        PRINT("Total objects present: %zu\n", objects.size());
+        PRINT("Total objects present: %zu\n", recovering_objects.size());
         return NULL;
     }
     return it->second;
@@ -203,8 +493,11 @@ void *NVManager::buildAbortChains(void *arg) {
     priority_queue<uint64_t, vector<uint64_t>, greater<uint64_t> > min_heap;
 
 
-    uint64_t max_committed_tx = 0;
-    uint64_t offset = log->head;
+    // Entries before the watermark were checked by a previous recovery
+    uint64_t max_committed_tx = log->watermark_commit;
+    uint64_t offset = std::max(log->head, log->watermark_offset);
+    PRINT("Manager: scanning %s from offset %zu (skipping %zu bytes)\n",
+            object->uuid_str, offset, offset - log->head);
     const char *data = (const char *)object->log;
     while (offset < log->tail) {
         assert(offset % CACHE_LINE_WIDTH == 0);
@@ -220,9 +513,9 @@ void *NVManager::buildAbortChains(void *arg) {
             continue;
         }
 
-        if (commit_id != 0) {
+        if (commit_id > max_committed_tx) {
             min_heap.push(commit_id);
-            while (min_heap.top() == max_committed_tx + 1) {
+            while (!min_heap.empty() && min_heap.top() == max_committed_tx + 1) {
                 max_committed_tx++;
                 min_heap.pop();
             }
@@ -378,3 +671,9 @@ void NVManager::registerThread(pthread_t thread, ThreadConfig *cfg) {
 void NVManager::unregisterThread(pthread_t thread) {
     program_threads.erase(thread);
 }
+
+ThreadConfig *NVManager::findThread(pthread_t thread) {
+    auto it = program_threads.find(thread);
+    if (it == program_threads.end()) return NULL;
+    return it->second;
+}
@@ -1,6 +1,9 @@
 #pragma once
+#include <list>
 #include <map>
+#include <string>
 #include <pthread.h>
+#include "config.hpp"
 
 using namespace std;
 class NVCatalog;
@@ -8,6 +11,8 @@ class PersistentObject;
 struct CatalogEntry;
 struct ThreadConfig;
 class Snapshot;
+class RecoveryPool;
+class RecoveryGraph;
 
 /*
  * Non-Volatile Memory Manager
@@ -34,41 +39,102 @@ class NVManager {
          * Create a new or find an existing persistent object
          * Find: tries to find an already recovered object
          * Create: saves the newly created object in the catalog
+         * Both assign the QoS class used to schedule logging of the object.
          */
-        PersistentObject *findRecovered(uuid_t);
-        void createNew(uint64_t, PersistentObject *);
+        PersistentObject *findRecovered(uuid_t, QosClass = QosDefault);
+        void createNew(uint64_t, PersistentObject *, QosClass = QosDefault);
 
         // Handles 'delete' for persistent objects
         void destroy(PersistentObject *);
 
-        // Find pointer to persistent objects using its unique identifier
+        /*
+         * Lazy recovery (PRONTO_RECOVERY=lazy)
+         * Objects are recovered in the background after the constructor
+         * returns, and findRecovered() returns objects that might still be
+         * recovering. Threads using an object must wait for it (generated
+         * factories and Savitar_thread_notify do), which moves the object to
+         * the front of the recovery queue.
+         * waitForRecovery: waits for all objects and snapshot pages to be
+         * restored (e.g., before snapshots)
+         */
+        void waitForObject(PersistentObject *);
+        void waitForRecovery();
+
+        /*
+         * Clean shutdown checkpoint (PRONTO_SHUTDOWN_SNAPSHOT=1)
+         * Called once all program threads have finished, takes a snapshot
+         * and truncates the logs it covers, so that the next startup only
+         * restores snapshot pages.
+         */
+        void shutdownCheckpoint();
+
+        // Saves the allocator state of the heap file (warm restart)
+        void saveWarmState();
+
+        /*
+         * Log bytes appended since the last snapshot, i.e., what a recovery
+         * would replay, in total and for the largest log (SnapshotScheduler)
+         */
+        void pendingLogBytes(uint64_t *total, uint64_t *largest);
+
+        // Find pointer to recovering objects using its unique identifier
         PersistentObject *findObject(string);
 
         const char *getArgumentPointer(CatalogEntry *);
 
         pthread_cond_t *ckptCondition() { return &_ckptCondition; }
         pthread_mutex_t *ckptLock() { return &_ckptLock; }
+        // Odd while a snapshot waits for running transactions
+        uint64_t snapshotEpoch() const { return snapshot_epoch; }
 
         void registerThread(pthread_t, ThreadConfig *);
         void unregisterThread(pthread_t);
+        ThreadConfig *findThread(pthread_t);
 
     private:
         pthread_mutex_t _lock;
         pthread_mutex_t _ckptLock;
         pthread_cond_t _ckptCondition;
+        volatile uint64_t snapshot_epoch = 2; // 0 = not in a transaction
         map<string, PersistentObject *> objects;
         NVCatalog *catalog = NULL;
         map<pthread_t, ThreadConfig *> program_threads;
 
+        // Recovery state, recovery_pool is NULL once recovery is complete
+        pthread_mutex_t _recoveryLock;
+        pthread_cond_t _recoveryCondition;
+        pthread_t recovery_thread;
+        bool background_recovery = false;
+        RecoveryPool *recovery_pool = NULL;
+        RecoveryGraph *recovery_graph = NULL;
+
+        /*
+         * Objects being recovered, copied before replay starts: recovery
+         * threads look up objects (findObject) without the manager lock,
+         * while factories insert new objects (lazy recovery)
+         */
+        map<string, PersistentObject *> recovering_objects;
+        struct timespec recovery_start;
+        uint64_t replay_start = 0;
+
         /*
          * Recovery methods
-         * recoverObject: Catalog calls this method to add objects to recovery queue
-         * recoveryWorker: for each object in the recovery queue, a new thread is
-         * created, which calls this method to run the recovery code for its
-         * argument object.
+         * recoverObjects: opens the objects of the catalog, objects restored
+         * from a snapshot are opened by a group of threads (reopenObject)
+         * recoverObject: constructs an object that is not in the snapshot
+         * recoveryStep: threads of the recovery pool call this method to run
+         * the recovery code for objects in the recovery queue, returns false
+         * if the object is waiting for another object.
          */
+        uint64_t recoverObjects(list< pair<string, CatalogEntry *> > &,
+                bool defer_logs);
+        static void *openObjects(void *);
+        bool reopenObject(PersistentObject *, CatalogEntry *, bool defer_log);
         void recoverObject(const char *, struct CatalogEntry *);
-        static void *recoveryWorker(void *);
+        static bool recoveryStep(PersistentObject *);
+        void finishRecovery();
+        static void *backgroundRecovery(void *);
+        void markUncleanShutdown();
 
         /*
          * Method to fix persistent log dependencies after an unclean shutdown
@@ -3,14 +3,12 @@
 #include "nv_object.hpp"
 #include "thread.hpp"
 
-#ifdef DEBUG
 static inline uint64_t rdtscp() {
   uint32_t aux;
   uint64_t rax, rdx;
   asm volatile ( "rdtscp\n" : "=a" (rax), "=d" (rdx), "=c" (aux) : : );
   return (rdx << 32) + rax;
 }
-#endif
 
 void *Savitar_persister_worker(void *arg) {
 
@@ -18,6 +16,11 @@ void *Savitar_persister_worker(void *arg) {
     uint64_t *tx_buffer = ((TxBuffers *)arg)->tx_buffer;
     int thread_id = ((TxBuffers *)arg)->thread_id;
     PersistentObject *nv_object = NULL;
+    const QosMode qos_mode = Savitar_config()->qos_mode;
+    const uint64_t qos_max_defer = Savitar_config()->qos_max_defer;
+    // Requests can be claimed by worker threads (see Savitar_hybrid_takeover)
+    const bool hybrid = Savitar_config()->logging_mode == LoggingHybrid ||
+        qos_mode == QosDedicated;
 
     /*
      * [Support for nested transactions]
@@ -48,20 +51,46 @@ void *Savitar_persister_worker(void *arg) {
             PRINT("[%d] Received TERM signal from the main thread\n", thread_id);
             break;
         }
+
+        if (active_tx_id > 0 && tx_buffer[active_tx_id] == 0) {
+            // we must first create undo-log for parent transaction
+            active_tx_id--;
+            continue;
+        }
+
+        /*
+         * [QoS priority]
+         * Give way to persisters of latency-critical objects, so that they
+         * get the memory bandwidth, for a bounded number of cycles
+         */
+        nv_object = (PersistentObject *)buffer[active_tx_id].obj_ptr;
+        if (qos_mode == QosPriority && pending_critical_requests > 0 &&
+                nv_object->getQosClass() != QosCritical) {
+            uint64_t start = rdtscp();
+            while (pending_critical_requests > 0 &&
+                    rdtscp() - start < qos_max_defer) {
+                asm volatile("pause");
+            }
+        }
+
+        /*
+         * [Hybrid logging]
+         * The worker thread takes over requests that we have not picked up
+         * within a threshold, so we must claim a request before logging it.
+         * Requests claimed by the worker are skipped until it clears them.
+         */
+        uint64_t method_tag = buffer[active_tx_id].method_tag;
+        if (hybrid) {
+            method_tag = Savitar_persister_claim(
+                    &buffer[active_tx_id].method_tag);
+            if (method_tag == 0) continue;
+        }
 #ifdef DEBUG
         uint64_t cycle = rdtscp();
 #endif
 
-        // Extract PersistentObject pointer and method tag
-        nv_object = (PersistentObject *)buffer[active_tx_id].obj_ptr;
-
         uint64_t log_offset;
         if (active_tx_id > 0) { // dependant (nested) transaction
-            if (tx_buffer[active_tx_id] == 0) {
-                // we must first create undo-log for parent transaction
-                active_tx_id--;
-                continue;
-            }
             ArgVector vector[2];
             uint64_t nested_tx_tag = tx_buffer[active_tx_id] | NESTED_TX_TAG;
             vector[0].addr = &nested_tx_tag;
@@ -79,7 +108,7 @@ void *Savitar_persister_worker(void *arg) {
         }
         else { // outer-most transaction
             // Delegate log creation to the logger function
-            log_offset = nv_object->Log(buffer[active_tx_id].method_tag,
+            log_offset = nv_object->Log(method_tag,
                     buffer[active_tx_id].arg_ptrs);
         }
         tx_buffer[active_tx_id + 1] = log_offset;
@@ -2,3 +2,40 @@
 #include "savitar.hpp"
 
 void *Savitar_persister_worker(void *);
+
+/*
+ * [QoS priority]
+ * Number of requests of latency-critical objects waiting to be logged
+ * Maintained by worker threads, see Savitar_thread_notify/wait.
+ */
+extern volatile uint64_t pending_critical_requests;
+
+/*
+ * [Hybrid logging]
+ * Requests are claimed before they are logged, either by the persister or
+ * by the worker (see Savitar_hybrid_takeover). The claim tag is cleared
+ * along with the method tag once the log entry is created.
+ */
+
+// Returns the method tag of the claimed request, 0 if there is none
+static inline uint64_t Savitar_persister_claim(volatile uint64_t *tag) {
+    uint64_t method_tag = *tag;
+    if (method_tag == 0 || (method_tag & WORKER_CLAIM_TAG)) return 0;
+    if (!__sync_bool_compare_and_swap(tag, method_tag,
+                method_tag | PERSISTER_CLAIM_TAG)) return 0;
+    return method_tag;
+}
+
+// Returns false if the request is (or is being) logged by the persister
+static inline bool Savitar_worker_claim(volatile uint64_t *tag) {
+    while (true) {
+        uint64_t method_tag = *tag;
+        if (method_tag == 0) return false; // already logged
+        if (method_tag & PERSISTER_CLAIM_TAG) {
+            while (*tag != 0) { } // persister is creating the entry
+            return false;
+        }
+        if (__sync_bool_compare_and_swap(tag, method_tag,
+                    method_tag | WORKER_CLAIM_TAG)) return true;
+    }
+}
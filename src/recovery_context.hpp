@@ -3,22 +3,23 @@
 #include <uuid/uuid.h>
 #include <cstring>
 #include <assert.h>
-#include <string>
-#include <map>
+#include <stdint.h>
+#include <vector>
 
 using namespace std;
 
 class NVManager;
+class RecoveryPool;
 
+/*
+ * Shared state of recovery threads
+ * Accessed on every replayed call, so the replay path is lock-free: parent
+ * objects are thread-local and log heads are a flat array indexed by the
+ * slot assigned to each object when the snapshot is loaded.
+ */
 class RecoveryContext {
     public:
-        RecoveryContext() {
-            pthread_mutex_init(&lock, NULL);
-        }
-
         ~RecoveryContext() {
-            pthread_mutex_destroy(&lock);
-            parentObjects.clear();
             logHeadOffsets.clear();
         }
 
@@ -30,44 +31,62 @@ class RecoveryContext {
         void setManager(NVManager *m) { manager = m; }
         NVManager *getManager() { return manager; }
 
+        void setPool(RecoveryPool *p) { pool = p; }
+        RecoveryPool *getPool() { return pool; }
+
+        /*
+         * Threads replaying semantic logs (recovery threads)
+         * Calls to recovering objects from other threads are not replayed,
+         * they wait for the object to recover (see NVManager::waitForObject).
+         */
+        static void setReplaying(bool value) { replaying() = value; }
+        static bool isReplaying() { return replaying(); }
+
         /*
          * Support for recovering nested transactions
          * Pop returns the caller object (NULL means non-nested Tx)
          * Push sets parent object to the provided Persistent Object
          */
         void pushParentObject(PersistentObject *parent) {
-            pthread_mutex_lock(&lock);
-            auto it = parentObjects.find(pthread_self());
-            assert(it == parentObjects.end());
-            parentObjects[pthread_self()] = parent;
-            pthread_mutex_unlock(&lock);
+            assert(parentObject() == NULL);
+            parentObject() = parent;
         }
 
         PersistentObject *popParentObject() {
-            PersistentObject *parent = NULL;
-            pthread_mutex_lock(&lock);
-            auto it = parentObjects.find(pthread_self());
-            if (it != parentObjects.end()) {
-                parent = it->second;
-                parentObjects.erase(it);
-            }
-            pthread_mutex_unlock(&lock);
+            PersistentObject *parent = parentObject();
+            parentObject() = NULL;
             return parent;
         }
 
-        void pushLogHeadOffset(string id, uint64_t head) {
-            logHeadOffsets.insert(pair<string, uint64_t>(id, head));
+        /*
+         * Log heads (offsets) of objects restored from the snapshot
+         * Slots are added by Snapshot::load, before recovery threads start,
+         * and objects without a slot (NoSlot) are replayed from the log head.
+         */
+        static const uint32_t NoSlot = (uint32_t)-1;
+
+        uint32_t addLogHeadOffset(uint64_t head) {
+            logHeadOffsets.push_back(head);
+            return logHeadOffsets.size() - 1;
         }
 
-        uint64_t queryLogHeadOffset(string id) {
-            auto it = logHeadOffsets.find(id);
-            if (it == logHeadOffsets.end()) return 0;
-            return it->second;
+        uint64_t queryLogHeadOffset(uint32_t slot) const {
+            if (slot >= logHeadOffsets.size()) return 0;
+            return logHeadOffsets[slot];
         }
 
     private:
+        static bool &replaying() {
+            static thread_local bool value = false;
+            return value;
+        }
+
+        static PersistentObject *&parentObject() {
+            static thread_local PersistentObject *parent = NULL;
+            return parent;
+        }
+
         NVManager *manager = NULL;
-        map<pthread_t, PersistentObject *> parentObjects;
-        pthread_mutex_t lock;
-        map<string, uint64_t> logHeadOffsets;
+        RecoveryPool *pool = NULL;
+        vector<uint64_t> logHeadOffsets;
 };
@@ -0,0 +1,254 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include "recovery_graph.hpp"
+#include "nv_object.hpp"
+#include "recovery_context.hpp"
+
+void RecoveryGraph::addObject(PersistentObject *object) {
+    assert(object->recovery_state == NULL);
+    object->recovery_state = new RecoveryState();
+    object->recovery_state->first_commit_id = object->last_played_commit_id;
+    objects.push_back(object);
+}
+
+void RecoveryGraph::clear() {
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        delete (*it)->recovery_state;
+        (*it)->recovery_state = NULL;
+    }
+    objects.clear();
+}
+
+/*
+ * Nodes of the graph are created for entries with nested transactions only,
+ * the rest of the entries of an object form chains between these nodes.
+ * Nodes are visited in topological order (Kahn), where a node is ready once
+ * it is the next node of all of its member objects. The distance of a node
+ * is the longest chain of entries that must be played before it, plus one.
+ */
+bool RecoveryGraph::criticalPath(uint64_t *length, uint64_t *entries) {
+    typedef struct NodeMember {
+        PersistentObject *object;
+        uint64_t first_commit_id;
+        uint64_t last_commit_id;
+    } NodeMember;
+
+    typedef struct Progress {
+        size_t next_node;
+        uint64_t last_commit_id; // last commit of the previous node
+        uint64_t distance;
+    } Progress;
+
+    map< pair<PersistentObject *, uint64_t>, size_t > node_ids;
+    vector< vector<NodeMember> > nodes;
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        vector<RecoveryEdge> &edges = (*it)->recovery_state->edges;
+        for (auto e = edges.begin(); e != edges.end(); ++e) {
+            auto key = make_pair(e->parent, e->parent_commit_id);
+            auto n = node_ids.find(key);
+            if (n == node_ids.end()) {
+                n = node_ids.insert(make_pair(key, nodes.size())).first;
+                NodeMember parent = { e->parent, e->parent_commit_id,
+                    e->parent_commit_id };
+                nodes.push_back(vector<NodeMember>(1, parent));
+            }
+            vector<NodeMember> &members = nodes[n->second];
+            bool found = false;
+            for (auto m = members.begin(); m != members.end(); ++m) {
+                if (m->object != *it) continue;
+                m->first_commit_id = std::min(m->first_commit_id, e->commit_id);
+                m->last_commit_id = std::max(m->last_commit_id, e->commit_id);
+                found = true;
+            }
+            if (!found) {
+                NodeMember child = { *it, e->commit_id, e->commit_id };
+                members.push_back(child);
+            }
+        }
+    }
+    if (nodes.empty()) return false;
+
+    // Nodes of each object in commit order
+    map< PersistentObject *, vector< pair<uint64_t, size_t> > > chains;
+    map<PersistentObject *, Progress> progress;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        for (auto m = nodes[n].begin(); m != nodes[n].end(); ++m) {
+            chains[m->object].push_back(make_pair(m->first_commit_id, n));
+        }
+    }
+
+    vector<size_t> ready(nodes.size(), 0);
+    queue<size_t> ready_nodes;
+    for (auto it = chains.begin(); it != chains.end(); ++it) {
+        sort(it->second.begin(), it->second.end());
+        Progress p = { 0, it->first->recovery_state->first_commit_id, 0 };
+        progress[it->first] = p;
+        size_t n = it->second[0].second;
+        if (++ready[n] == nodes[n].size()) ready_nodes.push(n);
+    }
+
+    while (!ready_nodes.empty()) {
+        size_t n = ready_nodes.front();
+        ready_nodes.pop();
+        uint64_t distance = 0;
+        for (auto m = nodes[n].begin(); m != nodes[n].end(); ++m) {
+            Progress &p = progress[m->object];
+            distance = std::max(distance,
+                    p.distance + (m->first_commit_id - 1 - p.last_commit_id));
+        }
+        distance++;
+        for (auto m = nodes[n].begin(); m != nodes[n].end(); ++m) {
+            Progress &p = progress[m->object];
+            p.last_commit_id = m->last_commit_id;
+            p.distance = distance;
+            vector< pair<uint64_t, size_t> > &chain = chains[m->object];
+            if (++p.next_node < chain.size()) {
+                size_t next = chain[p.next_node].second;
+                if (++ready[next] == nodes[next].size()) ready_nodes.push(next);
+            }
+        }
+    }
+
+    *length = 0;
+    *entries = 0;
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        PersistentObject *object = *it;
+        uint64_t first = object->recovery_state->first_commit_id;
+        uint64_t last = object->last_played_commit_id;
+        *entries += last - first;
+        auto p = progress.find(object);
+        uint64_t distance = last - first;
+        if (p != progress.end()) {
+            distance = p->second.distance + (last - p->second.last_commit_id);
+        }
+        *length = std::max(*length, distance);
+    }
+    return true;
+}
+
+RecordRing::RecordRing(size_t capacity) : mask(capacity - 1) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    records = (ScanRecord *)malloc(capacity * sizeof(ScanRecord));
+    assert(records != NULL);
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&not_full, NULL);
+    pthread_cond_init(&not_empty, NULL);
+}
+
+RecordRing::~RecordRing() {
+    free(records);
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&not_full);
+    pthread_cond_destroy(&not_empty);
+}
+
+/*
+ * Sleeping sides set their flag and check the ring again under the lock,
+ * while the other side updates its index, then checks the flag (full
+ * fences order the two on both sides), so that no wakeup is lost
+ */
+void RecordRing::push(const ScanRecord &record) {
+    while (tail - head > mask) {
+        pthread_mutex_lock(&lock);
+        producer_waiting = 1;
+        __sync_synchronize();
+        if (tail - head > mask) pthread_cond_wait(&not_full, &lock);
+        producer_waiting = 0;
+        pthread_mutex_unlock(&lock);
+    }
+    records[tail & mask] = record;
+    __sync_synchronize();
+    tail++;
+    __sync_synchronize();
+    if (consumer_waiting) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&not_empty);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+bool RecordRing::pop(ScanRecord *record) {
+    while (head == tail) {
+        if (closed) {
+            __sync_synchronize();
+            if (head == tail) return false;
+            break;
+        }
+        pthread_mutex_lock(&lock);
+        consumer_waiting = 1;
+        __sync_synchronize();
+        if (head == tail && !closed) pthread_cond_wait(&not_empty, &lock);
+        consumer_waiting = 0;
+        pthread_mutex_unlock(&lock);
+    }
+    *record = records[head & mask];
+    __sync_synchronize();
+    head++;
+    __sync_synchronize();
+    if (producer_waiting) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&not_full);
+        pthread_mutex_unlock(&lock);
+    }
+    return true;
+}
+
+void RecordRing::close() {
+    pthread_mutex_lock(&lock);
+    closed = 1;
+    pthread_cond_signal(&not_empty);
+    pthread_mutex_unlock(&lock);
+}
+
+PartitionReplay::PartitionReplay(const vector<PartitionRecord> &records,
+        size_t count, size_t threads, PartitionPlay play, void *context) :
+        records(records), count(count), threads(std::max(threads, (size_t)1)),
+        play(play), context(context) {
+    assert(count <= records.size());
+    pthread_barrier_init(&barrier, NULL, this->threads);
+}
+
+PartitionReplay::~PartitionReplay() {
+    pthread_barrier_destroy(&barrier);
+}
+
+void PartitionReplay::run() {
+    vector<pthread_t> workers(threads - 1);
+    vector<WorkerArg> args(threads);
+    for (size_t t = 1; t < threads; t++) {
+        args[t] = { this, t };
+        assert(pthread_create(&workers[t - 1], NULL, workerMain, &args[t]) == 0);
+    }
+    replay(0);
+    for (size_t t = 1; t < threads; t++) pthread_join(workers[t - 1], NULL);
+}
+
+void *PartitionReplay::workerMain(void *arg) {
+    WorkerArg *worker = (WorkerArg *)arg;
+    RecoveryContext::setReplaying(true);
+    worker->replay->replay(worker->thread_id);
+    return NULL;
+}
+
+void PartitionReplay::replay(size_t thread_id) {
+    size_t begin = 0;
+    while (begin < count) {
+        size_t end = begin;
+        for (; end < count && records[end].partition != AllPartitions; end++) {
+            if (records[end].partition % threads != thread_id) continue;
+            play(context, records[end]);
+        }
+        if (end == count) break;
+
+        pthread_barrier_wait(&barrier);
+        begin = end;
+        while (begin < count && records[begin].partition == AllPartitions) {
+            if (thread_id == 0) play(context, records[begin]);
+            begin++;
+        }
+        pthread_barrier_wait(&barrier);
+    }
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+class PersistentObject;
+
+class CommitRecord {
+    public:
+        CommitRecord(char *ptr, uint64_t commit_id, uint64_t method_tag) {
+            _ptr = ptr;
+            _commit_id = commit_id;
+            _method_tag = method_tag;
+        }
+
+        uint64_t getCommitId() const { return _commit_id; }
+        uint64_t getMethodTag() const { return _method_tag; }
+        char *getPtr() const { return _ptr; }
+
+    private:
+        char *_ptr;
+        uint64_t _commit_id;
+        uint64_t _method_tag;
+};
+
+inline bool operator< (const CommitRecord& lhs, const CommitRecord& rhs) {
+    return lhs.getCommitId() > rhs.getCommitId(); // Force ASC order for priority queue
+}
+
+/*
+ * Log record streamed from the scanner to the applier (pipelined replay)
+ */
+typedef struct ScanRecord {
+    char *ptr;
+    uint64_t commit_id;
+    uint64_t method_tag;
+} ScanRecord;
+
+/*
+ * Single-producer single-consumer ring of log records
+ * * The scanner thread pushes records in log order and the applier, i.e.
+ *   Recover(), pops them. Log order is mostly commit order, so the applier
+ *   plays most records right away and only sorts the rest.
+ * * Both sides only take the lock to sleep when the ring is full (scanner)
+ *   or empty (applier).
+ */
+class RecordRing {
+    public:
+        RecordRing(size_t capacity);
+        ~RecordRing();
+
+        // Blocks while the ring is full
+        void push(const ScanRecord &);
+        // Blocks while the ring is empty, returns false after close()
+        bool pop(ScanRecord *);
+        // Called by the scanner at the end of the log
+        void close();
+
+    private:
+        ScanRecord *records;
+        const uint64_t mask;
+        volatile uint64_t head __attribute__((aligned(64))) = 0;
+        volatile uint64_t tail __attribute__((aligned(64))) = 0;
+        volatile uint64_t closed = 0;
+        volatile uint64_t producer_waiting = 0;
+        volatile uint64_t consumer_waiting = 0;
+        pthread_mutex_t lock;
+        pthread_cond_t not_full;
+        pthread_cond_t not_empty;
+};
+
+/*
+ * [Partitioned recovery]
+ * Log record of an object that replays its log in partitions
+ * partition: AllPartitions for operations that must see all prior entries
+ */
+typedef struct PartitionRecord {
+    uint64_t commit_id;
+    uint64_t method_tag;
+    char *ptr;
+    size_t partition;
+} PartitionRecord;
+
+inline bool operator< (const PartitionRecord& lhs, const PartitionRecord& rhs) {
+    return lhs.commit_id < rhs.commit_id;
+}
+
+// Plays a record on behalf of the context (i.e., the object)
+typedef void (*PartitionPlay)(void *context, const PartitionRecord &);
+
+/*
+ * Replays records sorted by commit id using a group of threads
+ * * The group is created once and the calling thread is part of it. Each
+ *   thread plays a subset of the partitions, in commit order.
+ * * Records that belong to all partitions split the records into segments.
+ *   The group meets at a barrier before and after the first thread plays
+ *   them, so they see every prior record and every later record sees them.
+ */
+class PartitionReplay {
+    public:
+        static const size_t AllPartitions = (size_t)-1;
+
+        PartitionReplay(const vector<PartitionRecord> &records, size_t count,
+                size_t threads, PartitionPlay play, void *context);
+        ~PartitionReplay();
+
+        // Plays the first count records (blocking)
+        void run();
+
+    private:
+        typedef struct WorkerArg {
+            PartitionReplay *replay;
+            size_t thread_id;
+        } WorkerArg;
+
+        static void *workerMain(void *);
+        void replay(size_t thread_id);
+
+        const vector<PartitionRecord> &records;
+        const size_t count;
+        const size_t threads;
+        PartitionPlay play;
+        void *context;
+        pthread_barrier_t barrier;
+};
+
+/*
+ * Dependency between a nested log entry of a child object (commit_id) and
+ * the entry of its parent object (parent_commit_id) that executes it
+ */
+typedef struct RecoveryEdge {
+    uint64_t commit_id;
+    PersistentObject *parent;
+    uint64_t parent_commit_id;
+} RecoveryEdge;
+
+/*
+ * Volatile recovery state of a persistent object
+ * * Progress of Recover() while the object is suspended
+ * * Objects waiting for commits of this object (woken up in commit order)
+ * * Condition signaled once the object waits for a parent, which lets the
+ *   parent execute the nested call (see Savitar_thread_notify)
+ */
+struct RecoveryState {
+    volatile uint64_t running = 0; // Recover() is being executed
+    bool started = false;
+    char *ptr = NULL;
+    const char *limit = NULL;
+    // Data-structures to handle out-of-order entries
+    priority_queue<CommitRecord> commit_queue;
+    // Pipelined replay (large logs only)
+    RecordRing *ring = NULL;
+    pthread_t scanner;
+
+    pthread_mutex_t lock;
+    pthread_cond_t parked;
+    volatile uint64_t waiter_count = 0;
+    vector< pair<uint64_t, PersistentObject *> > waiters;
+
+    // Statistics (see RecoveryReport)
+    uint64_t log_bytes = 0;
+    uint64_t replay_ns = 0;
+    uint64_t blocked_ns = 0;
+    uint64_t suspended_at = 0;
+
+    // Dependency graph (nested transactions)
+    uint64_t first_commit_id = 0;
+    vector<RecoveryEdge> edges;
+
+    RecoveryState() {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&parked, NULL);
+    }
+
+    ~RecoveryState() {
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&parked);
+    }
+};
+
+/*
+ * Recovery dependency graph
+ * Nodes are (object, commit id) pairs and edges are the commit order within
+ * each object plus the nested transactions recorded by Recover(). Nested
+ * entries are played by their parent, so a parent entry and the nested
+ * entries of its children form one node of the graph.
+ */
+class RecoveryGraph {
+    public:
+        // Allocates the recovery state of the object before recovery starts
+        void addObject(PersistentObject *);
+
+        /*
+         * Length of the longest chain of dependent log entries, which bounds
+         * the recovery time regardless of the number of recovery threads
+         * Must be called after recovery, returns false without any edges.
+         */
+        bool criticalPath(uint64_t *length, uint64_t *entries);
+
+        // Releases the recovery state of all objects
+        void clear();
+
+    private:
+        vector<PersistentObject *> objects;
+};
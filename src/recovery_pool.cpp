@@ -0,0 +1,231 @@
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "recovery_pool.hpp"
+#include "recovery_context.hpp"
+#include "savitar.hpp"
+
+RecoveryPool::RecoveryPool(size_t threads, RecoveryStep step) :
+        pool_size(threads), step(step) {
+    assert(pool_size > 0);
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&work_available, NULL);
+    workers = new Worker[pool_size];
+    for (size_t i = 0; i < pool_size; i++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        workers[i].assigned_bytes = 0;
+    }
+}
+
+RecoveryPool::~RecoveryPool() {
+    for (size_t i = 0; i < pool_size; i++) {
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    delete[] workers;
+    pthread_cond_destroy(&work_available);
+    pthread_mutex_destroy(&lock);
+}
+
+void RecoveryPool::add(PersistentObject *object, uint64_t log_bytes) {
+    Task task = { .object = object, .log_bytes = log_bytes };
+    tasks.push_back(task);
+}
+
+void RecoveryPool::start() {
+    // Largest logs first, each to the least loaded worker
+    sort(tasks.begin(), tasks.end(), [](const Task &a, const Task &b) {
+            return a.log_bytes > b.log_bytes; });
+    for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+        Worker *target = &workers[0];
+        for (size_t i = 1; i < pool_size; i++) {
+            if (workers[i].assigned_bytes < target->assigned_bytes) {
+                target = &workers[i];
+            }
+        }
+        target->queue.push_back(it->object);
+        target->assigned_bytes += it->log_bytes;
+    }
+    remaining_objects = tasks.size();
+    queued_objects = tasks.size();
+    PRINT("Recovery pool: %zu objects, %zu threads\n", tasks.size(), pool_size);
+
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < pool_size && i < tasks.size(); i++) spawn(i);
+    pthread_mutex_unlock(&lock);
+}
+
+void RecoveryPool::wait() {
+    /*
+     * Compensation workers are only started by running workers, so once
+     * we have joined every thread in the list, no more threads can be added
+     */
+    for (size_t i = 0; ; i++) {
+        pthread_mutex_lock(&lock);
+        if (i == threads.size()) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        pthread_t thread = threads[i];
+        pthread_mutex_unlock(&lock);
+        pthread_join(thread, NULL);
+    }
+    assert(remaining_objects == 0);
+    PRINT("Recovery pool: finished with %zu threads\n", threads.size());
+    tasks.clear();
+    threads.clear();
+}
+
+// Must be called with the pool lock held
+void RecoveryPool::spawn(size_t worker_id) {
+    WorkerArg *arg = (WorkerArg *)malloc(sizeof(WorkerArg));
+    arg->pool = this;
+    arg->worker_id = worker_id;
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, workerMain, arg) == 0);
+    threads.push_back(thread);
+    running_threads++;
+}
+
+PersistentObject *RecoveryPool::next(size_t worker_id) {
+    PersistentObject *object = NULL;
+    if (worker_id < pool_size) {
+        Worker *me = &workers[worker_id];
+        pthread_mutex_lock(&me->lock);
+        if (!me->queue.empty()) {
+            object = me->queue.front();
+            me->queue.pop_front();
+        }
+        pthread_mutex_unlock(&me->lock);
+        if (object != NULL) {
+            __sync_fetch_and_sub(&queued_objects, 1);
+            return object;
+        }
+    }
+
+    for (size_t i = 1; i <= pool_size; i++) {
+        Worker *victim = &workers[(worker_id + i) % pool_size];
+        pthread_mutex_lock(&victim->lock);
+        if (!victim->queue.empty()) {
+            object = victim->queue.back();
+            victim->queue.pop_back();
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (object != NULL) {
+            __sync_fetch_and_sub(&queued_objects, 1);
+            return object;
+        }
+    }
+    return NULL;
+}
+
+// Resumed objects go first, as other objects might be waiting for them
+void RecoveryPool::resume(PersistentObject *object) {
+    pthread_mutex_lock(&lock);
+    Worker *target = &workers[resumed_objects++ % pool_size];
+    __sync_fetch_and_add(&queued_objects, 1);
+    pthread_mutex_unlock(&lock);
+
+    pthread_mutex_lock(&target->lock);
+    target->queue.push_front(object);
+    pthread_mutex_unlock(&target->lock);
+
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&lock);
+}
+
+void RecoveryPool::prioritize(PersistentObject *object) {
+    for (size_t i = 0; i < pool_size; i++) {
+        Worker *worker = &workers[i];
+        pthread_mutex_lock(&worker->lock);
+        auto it = find(worker->queue.begin(), worker->queue.end(), object);
+        if (it != worker->queue.end()) {
+            worker->queue.erase(it);
+            worker->queue.push_front(object);
+            pthread_mutex_unlock(&worker->lock);
+            PRINT("Recovery pool: prioritized object %p\n", (void *)object);
+            return;
+        }
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
+
+void *RecoveryPool::workerMain(void *arg) {
+    RecoveryPool *pool = ((WorkerArg *)arg)->pool;
+    const size_t worker_id = ((WorkerArg *)arg)->worker_id;
+    free(arg);
+    RecoveryContext::setReplaying(true);
+
+    while (pool->remaining_objects > 0) {
+        PersistentObject *object = pool->next(worker_id);
+        if (object == NULL) {
+            // Objects are queued or resumed with the pool lock held
+            pthread_mutex_lock(&pool->lock);
+            pool->waiting_threads++;
+            while (pool->queued_objects == 0 && pool->remaining_objects > 0) {
+                pthread_cond_wait(&pool->work_available, &pool->lock);
+            }
+            pool->waiting_threads--;
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        // Suspended objects are resumed by the objects they wait for
+        if (pool->step(object) &&
+                __sync_sub_and_fetch(&pool->remaining_objects, 1) == 0) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->work_available);
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        // Compensation workers leave once enough workers are unblocked
+        if (worker_id < pool->pool_size) continue;
+        pthread_mutex_lock(&pool->lock);
+        if (pool->running_threads - pool->blocked_threads > pool->pool_size) {
+            pool->running_threads--;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running_threads--;
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+void RecoveryPool::beginBlocking() {
+    pthread_mutex_lock(&lock);
+    blocked_threads++;
+    if (blocked_threads == running_threads && remaining_objects > 0) {
+        PRINT("Recovery pool: all workers blocked, adding a worker\n");
+        spawn(pool_size + threads.size());
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void RecoveryPool::endBlocking() {
+    pthread_mutex_lock(&lock);
+    assert(blocked_threads > 0);
+    blocked_threads--;
+    pthread_mutex_unlock(&lock);
+}
+
+size_t RecoveryPool::borrowThreads(size_t wanted) {
+    pthread_mutex_lock(&lock);
+    size_t busy = running_threads - blocked_threads - waiting_threads +
+        lent_threads;
+    size_t lent = busy < pool_size ? std::min(wanted, pool_size - busy) : 0;
+    lent_threads += lent;
+    pthread_mutex_unlock(&lock);
+    return lent;
+}
+
+void RecoveryPool::returnThreads(size_t count) {
+    pthread_mutex_lock(&lock);
+    assert(lent_threads >= count);
+    lent_threads -= count;
+    pthread_mutex_unlock(&lock);
+}
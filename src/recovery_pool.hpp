@@ -0,0 +1,106 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+class PersistentObject;
+
+/*
+ * Runs one recovery step for the object
+ * Returns false if the object is waiting for another object (suspended),
+ * in which case it is scheduled again through resume(), or true once the
+ * object is recovered.
+ */
+typedef bool (*RecoveryStep)(PersistentObject *);
+
+/*
+ * Work-stealing thread pool for recovering persistent objects
+ * * Objects are assigned to workers largest log first, each worker taking
+ *   the next object while it has the least total log bytes assigned.
+ * * Workers recover their own objects in order and steal from the tail of
+ *   other workers' queues once they run out of work.
+ * * Suspended objects (nested transactions waiting for their parent) leave
+ *   the pool until the parent resumes them, so that workers only run
+ *   objects that can make progress, and idle workers sleep.
+ * * Workers replaying a parent block until the child is ready to execute
+ *   the nested call (see beginBlocking), and if all workers are blocked,
+ *   the pool starts a compensation worker to keep recovery going.
+ */
+class RecoveryPool {
+    public:
+        RecoveryPool(size_t threads, RecoveryStep step);
+        ~RecoveryPool();
+
+        void add(PersistentObject *object, uint64_t log_bytes);
+
+        // Recovers all objects using the pool threads (blocking)
+        void run() { start(); wait(); }
+
+        // Starts recovering objects in the background
+        void start();
+
+        // Waits for all objects to recover
+        void wait();
+
+        // Schedules a suspended object again
+        void resume(PersistentObject *);
+
+        // Moves a queued object to the front, as a thread is waiting for it
+        void prioritize(PersistentObject *);
+
+        // Called by pool threads around waits that can not be suspended
+        void beginBlocking();
+        void endBlocking();
+
+        size_t size() const { return pool_size; }
+
+        /*
+         * Lends up to the given number of threads to a pool thread that
+         * replays an object in parallel (e.g., partitioned replay), out of
+         * the pool threads that are not recovering objects. Returns the
+         * number of threads lent, to be given back through returnThreads.
+         */
+        size_t borrowThreads(size_t);
+        void returnThreads(size_t);
+
+    private:
+        typedef struct Task {
+            PersistentObject *object;
+            uint64_t log_bytes;
+        } Task;
+
+        typedef struct Worker {
+            pthread_mutex_t lock;
+            deque<PersistentObject *> queue;
+            uint64_t assigned_bytes;
+        } Worker;
+
+        typedef struct WorkerArg {
+            RecoveryPool *pool;
+            size_t worker_id; // compensation workers have no queue
+        } WorkerArg;
+
+        const size_t pool_size;
+        RecoveryStep step;
+        vector<Task> tasks;
+        Worker *workers = NULL;
+
+        // Protects the fields below
+        pthread_mutex_t lock;
+        pthread_cond_t work_available;
+        volatile uint64_t queued_objects = 0;
+        uint64_t resumed_objects = 0;
+        vector<pthread_t> threads;
+        size_t running_threads = 0;
+        size_t blocked_threads = 0;
+        size_t waiting_threads = 0; // for work_available
+        size_t lent_threads = 0;
+        volatile uint64_t remaining_objects = 0;
+
+        static void *workerMain(void *);
+        void spawn(size_t worker_id);
+        PersistentObject *next(size_t worker_id);
+};
@@ -0,0 +1,117 @@
+#include <assert.h>
+#include <time.h>
+#include "recovery_report.hpp"
+#include "savitar.hpp"
+
+static const char *phase_names[RecoveryPhases] = {
+    "catalog_open", "snapshot_map", "page_restore", "allocator_restore",
+    "object_open", "log_fixup", "replay"
+};
+
+RecoveryReport::RecoveryReport() {
+    pthread_mutex_init(&lock, NULL);
+    for (size_t p = 0; p < RecoveryPhases; p++) phase_ns[p] = 0;
+}
+
+uint64_t RecoveryReport::now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+void RecoveryReport::addPhase(RecoveryPhase phase, uint64_t ns) {
+    assert(phase < RecoveryPhases);
+    pthread_mutex_lock(&lock);
+    phase_ns[phase] += ns;
+    pthread_mutex_unlock(&lock);
+}
+
+void RecoveryReport::setPageRestore(uint64_t bytes, bool lazy,
+        uint64_t faulted, uint64_t object, uint64_t prefetched) {
+    pthread_mutex_lock(&lock);
+    restore_bytes = bytes;
+    lazy_restore = lazy;
+    faulted_blocks = faulted;
+    object_blocks = object;
+    prefetched_blocks = prefetched;
+    pthread_mutex_unlock(&lock);
+}
+
+void RecoveryReport::addObject(const ObjectRecoveryReport &object) {
+    pthread_mutex_lock(&lock);
+    objects.push_back(object);
+    pthread_mutex_unlock(&lock);
+}
+
+uint64_t RecoveryReport::replayRate() {
+    uint64_t bytes = 0;
+    uint64_t ns = 0;
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < objects.size(); i++) {
+        bytes += objects[i].log_bytes;
+        ns += objects[i].replay_ns;
+    }
+    pthread_mutex_unlock(&lock);
+    if (bytes < ((size_t)1 << 20) || ns == 0) return 0; // 1 MB
+    return (uint64_t)((double)bytes * 1E9 / ns);
+}
+
+void RecoveryReport::beginPart() {
+    __sync_fetch_and_add(&pending_parts, 1);
+}
+
+void RecoveryReport::endPart() {
+    assert(pending_parts > 0);
+    if (__sync_sub_and_fetch(&pending_parts, 1) == 0) publish();
+}
+
+void RecoveryReport::publish() {
+    const char *path = Savitar_config()->recovery_report;
+    if (path == NULL) return;
+    FILE *file = fopen(path, "a");
+    if (file == NULL) {
+        PRINT("Recovery report: unable to open %s\n", path);
+        return;
+    }
+    write(file);
+    fclose(file);
+}
+
+void Savitar_recovery_report(FILE *file) {
+    RecoveryReport::getInstance().write(file);
+}
+
+void RecoveryReport::write(FILE *file) {
+    pthread_mutex_lock(&lock);
+    uint64_t restore_ns = phase_ns[PhasePageRestore];
+    double restore_throughput = 0; // MB/s
+    if (restore_ns > 0) {
+        restore_throughput = (double)restore_bytes * 1E3 / restore_ns;
+    }
+
+    fprintf(file, "{\"clean_shutdown\":%s,\"startup_ns\":%zu,"
+            "\"recovery_ns\":%zu,\"prologue_ns\":%zu,\"deferred_logs\":%zu,"
+            "\"phases_ns\":{", clean_shutdown ? "true" : "false", startup_ns,
+            recovery_ns, prologue_ns, deferred_logs);
+    for (size_t p = 0; p < RecoveryPhases; p++) {
+        fprintf(file, "%s\"%s\":%zu", p > 0 ? "," : "", phase_names[p],
+                phase_ns[p]);
+    }
+    fprintf(file, "},\"page_restore\":{\"mode\":\"%s\",\"bytes\":%zu,"
+            "\"mb_per_s\":%.2f,\"faulted_blocks\":%zu,"
+            "\"object_blocks\":%zu,\"prefetched_blocks\":%zu},"
+            "\"objects\":[", lazy_restore ? "lazy" : "eager", restore_bytes,
+            restore_throughput, faulted_blocks, object_blocks,
+            prefetched_blocks);
+    for (size_t i = 0; i < objects.size(); i++) {
+        const ObjectRecoveryReport &o = objects[i];
+        uint64_t ns_per_entry = o.entries > 0 ? o.replay_ns / o.entries : 0;
+        fprintf(file, "%s{\"uuid\":\"%s\",\"log_bytes\":%zu,\"entries\":%zu,"
+                "\"replay_ns\":%zu,\"replay_ns_per_entry\":%zu,"
+                "\"blocked_ns\":%zu}", i > 0 ? "," : "", o.uuid.c_str(),
+                o.log_bytes, o.entries, o.replay_ns, ns_per_entry,
+                o.blocked_ns);
+    }
+    fprintf(file, "]}\n");
+    pthread_mutex_unlock(&lock);
+}
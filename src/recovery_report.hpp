@@ -0,0 +1,89 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef enum {
+    PhaseCatalogOpen = 0,       // NVCatalog
+    PhaseSnapshotMap = 1,       // mapping the snapshot file
+    PhasePageRestore = 2,       // heap pages (background with lazy restore)
+    PhaseAllocatorRestore = 3,  // object allocators and free blocks
+    PhaseObjectOpen = 4,        // recoverObject (logs and volatile state)
+    PhaseLogFixup = 5,          // emulateRecoveryAndFixRedoLogs
+    PhaseReplay = 6,            // recovery pool
+    RecoveryPhases = 7
+} RecoveryPhase;
+
+typedef struct ObjectRecoveryReport {
+    string uuid;
+    uint64_t log_bytes;     // bytes of the log scanned (head to tail)
+    uint64_t entries;       // entries replayed
+    uint64_t replay_ns;     // time spent in Recover()
+    uint64_t blocked_ns;    // time suspended, waiting for parent objects
+} ObjectRecoveryReport;
+
+/*
+ * Breakdown of the last recovery (startup) of the program
+ * * Filled in by NVManager, Snapshot and SnapshotRestore while recovering.
+ * * Replay and lazy page restore finish independently, so each registers a
+ *   part and the report is complete once all parts have ended.
+ * * Complete reports are appended as one JSON object per line to the file
+ *   named by PRONTO_RECOVERY_REPORT (if set).
+ */
+class RecoveryReport {
+public:
+    static RecoveryReport &getInstance() {
+        static RecoveryReport instance;
+        return instance;
+    }
+
+    // Monotonic clock (ns)
+    static uint64_t now();
+
+    void addPhase(RecoveryPhase, uint64_t ns);
+    void setPageRestore(uint64_t bytes, bool lazy, uint64_t faulted_blocks,
+            uint64_t object_blocks, uint64_t prefetched_blocks);
+    void setCleanShutdown(bool clean) { clean_shutdown = clean; }
+    void setStartupTime(uint64_t ns) { startup_ns = ns; }
+    void setRecoveryTime(uint64_t ns) { recovery_ns = ns; }
+    // Startup work before the recovery pool starts (serial path)
+    void setPrologue(uint64_t ns, uint64_t deferred) {
+        prologue_ns = ns;
+        deferred_logs = deferred;
+    }
+    void addObject(const ObjectRecoveryReport &);
+
+    // Replay rate of a recovery thread (bytes/s), 0 if too little was replayed
+    uint64_t replayRate();
+
+    void beginPart();
+    void endPart();
+    bool isComplete() const { return pending_parts == 0; }
+
+    // Writes the report as a single-line JSON object
+    void write(FILE *);
+
+private:
+    RecoveryReport();
+    void publish();
+
+    pthread_mutex_t lock;
+    volatile uint64_t pending_parts = 0;
+
+    bool clean_shutdown = true;
+    uint64_t startup_ns = 0;
+    uint64_t recovery_ns = 0;
+    uint64_t prologue_ns = 0;
+    uint64_t deferred_logs = 0; // mapped by recovery threads
+    uint64_t phase_ns[RecoveryPhases];
+    uint64_t restore_bytes = 0;
+    bool lazy_restore = false;
+    uint64_t faulted_blocks = 0;
+    uint64_t object_blocks = 0; // restored by recovery threads
+    uint64_t prefetched_blocks = 0;
+    vector<ObjectRecoveryReport> objects;
+};
@@ -8,12 +8,18 @@
 #include "nvm_manager.hpp"
 #include "nv_factory.hpp"
 #include "stl_alloc.hpp"
+#include "config.hpp"
 
 #define MAX_THREADS                 64
 #define CACHE_LINE_WIDTH            64
 #define BUFFER_SIZE                 8
 #define MAX_CORES                   40
 #define MAX_ACTIVE_TXS              15
+#define TX_BUFFER_ISSUED            (MAX_ACTIVE_TXS + 1) // outer-most txs
+#define TX_BUFFER_DURABLE           (MAX_ACTIVE_TXS + 2) // committed txs
+#define TX_BUFFER_EPOCH             (MAX_ACTIVE_TXS + 3) // snapshot epoch
+#define TX_BUFFER_BARRIERS          (MAX_ACTIVE_TXS + 4) // waiting barriers
+#define TX_BUFFER_SIZE              (MAX_ACTIVE_TXS + 5)
 #define CATALOG_FILE_NAME           "savitar.cat"
 #define CATALOG_FILE_SIZE           ((size_t)8 << 20) // 8 MB
 #define CATALOG_HEADER_SIZE         ((size_t)2 << 20) // 2 MB
@@ -23,6 +29,16 @@
 #endif
 #define NESTED_TX_TAG               0x8000000000000000
 #define REDO_LOG_MAGIC              0x5265646F4C6F6745 // RedoLogE
+#define PERSISTER_CLAIM_TAG         0x4000000000000000 // hybrid logging
+#define WORKER_CLAIM_TAG            0x2000000000000000 // hybrid logging
+#define CLAIM_TAG_MASK              (PERSISTER_CLAIM_TAG | WORKER_CLAIM_TAG)
+#define HYBRID_THRESHOLD            20000 // cycles
+#define QOS_MAX_DEFER               100000 // cycles
+#define QOS_HISTOGRAM_BUCKETS       64 // log2(cycles)
+#define RECOVERY_PIPELINE_BYTES     ((size_t)1 << 20) // 1 MB
+#define RECOVERY_RING_SIZE          4096 // records
+#define RECOVERY_PREFETCH_DISTANCE  2048 // bytes
+#define REPLAY_RATE                 100 // MB/s per recovery thread
 
 #ifdef DEBUG
 #define PRINT(format, ...)          fprintf(stdout, format, ## __VA_ARGS__)
@@ -46,3 +62,60 @@ int Savitar_thread_create(pthread_t *, const pthread_attr_t *,
 void Savitar_thread_notify(int, ...);
 
 void Savitar_thread_wait(PersistentObject *, SavitarLog *);
+
+/*
+ * Durability barriers: return once every operation issued so far by the
+ * thread (or by any thread on the object) is committed to its log.
+ * Must not be called from within a persistent operation.
+ */
+void Savitar_barrier(pthread_t);
+void Savitar_barrier(PersistentObject *);
+
+/*
+ * Number of log entries created by persister threads (asynchronous) and
+ * by worker threads taking over from a busy persister (inline)
+ */
+void Savitar_logging_stats(uint64_t *async_entries, uint64_t *inline_entries);
+
+/*
+ * Latency of persistent operations (notify to commit) per QoS class,
+ * collected unless PRONTO_QOS is off. Percentiles are upper bounds of
+ * power-of-two histogram buckets.
+ */
+typedef struct QosLatency {
+    uint64_t operations;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    uint64_t p50_cycles;
+    uint64_t p99_cycles;
+} QosLatency;
+
+void Savitar_qos_stats(QosClass, QosLatency *);
+
+/*
+ * Duration of the synchronous (stop-the-world) stage of the snapshots taken
+ * by this process, in microseconds. Percentiles are upper bounds of
+ * power-of-two histogram buckets.
+ */
+typedef struct SnapshotLatency {
+    uint64_t snapshots;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t p50_us;
+    uint64_t p99_us;
+} SnapshotLatency;
+
+void Savitar_snapshot_stats(SnapshotLatency *);
+
+/*
+ * Takes a snapshot and returns its identifier once it is complete (waits
+ * for a snapshot in progress first). Must not be called from inside a
+ * persistent operation, since the snapshot waits for running transactions.
+ */
+uint32_t Savitar_snapshot();
+
+/*
+ * Writes the breakdown of the last recovery (phases, snapshot pages and
+ * per-object replay) as one JSON object per line (see RecoveryReport)
+ */
+void Savitar_recovery_report(FILE *);
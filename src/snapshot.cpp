@@ -4,6 +4,8 @@
 #include "nv_object.hpp"
 #include "thread.hpp"
 #include "recovery_context.hpp"
+#include "snapshot_restore.hpp"
+#include "recovery_report.hpp"
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -14,14 +16,26 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <algorithm>
+#include <map>
+#include <set>
 
 #define CAS(a,b,c) __sync_bool_compare_and_swap(a,b,c)
 
 Snapshot *Snapshot::instance = NULL;
+const size_t Snapshot::ChunkBlocks;
+volatile uint8_t *Snapshot::dirtyBlocks = NULL;
+size_t Snapshot::trackedBlocks = 0;
+uint32_t Snapshot::trackedSnapshot = 0;
+uint32_t Snapshot::chainLength = 0;
+uint64_t Snapshot::syncHistogram[SNAPSHOT_HISTOGRAM_BUCKETS];
+uint64_t Snapshot::syncTotal = 0;
+uint64_t Snapshot::syncMax = 0;
+std::thread *Snapshot::collector = NULL;
 
 Snapshot::Snapshot(const char *snapshotPath) {
     assert(Snapshot::instance == NULL);
     rootPath = snapshotPath;
+    warmPath = rootPath / "warm.state";
     fd = 0;
     view = NULL;
     context = NULL;
@@ -53,6 +67,34 @@ void Snapshot::getExistingSnapshots(std::vector<uint32_t> &snapshots) {
     std::sort(snapshots.begin(), snapshots.end());
 }
 
+size_t Snapshot::deltaMapSize() {
+    return (GlobalAlloc::MaxMemorySize / FreeList::BlockSize) >> 3;
+}
+
+bool Snapshot::trackWrite(void *addr) {
+    const uintptr_t LB = GlobalAlloc::BaseAddress;
+    const uintptr_t UB = LB + trackedBlocks * FreeList::BlockSize;
+    if (dirtyBlocks == NULL || (uintptr_t)addr < LB || (uintptr_t)addr >= UB) {
+        return false;
+    }
+    uintptr_t alignedAddr = (uintptr_t)addr & ~(FreeList::BlockSize - 1);
+    dirtyBlocks[(alignedAddr - LB) >> 21] = 1; // before the write goes through
+    assert(mprotect((void *)alignedAddr, FreeList::BlockSize,
+                PROT_READ | PROT_WRITE) == 0);
+    return true;
+}
+
+/*
+ * Incremental snapshots need all blocks modified since the last snapshot of
+ * this process to be tracked, and the chain of snapshots up to the full one
+ * to be intact (i.e., no other process has taken a snapshot since)
+ */
+bool Snapshot::isIncremental() {
+    uint64_t limit = Savitar_config()->incremental_snapshots;
+    if (limit == 0 || trackedBlocks == 0 || chainLength >= limit) return false;
+    return lastSnapshotID() == trackedSnapshot;
+}
+
 uint32_t Snapshot::lastSnapshotID() {
     std::vector<uint32_t> snapshots;
     getExistingSnapshots(snapshots);
@@ -60,11 +102,109 @@ uint32_t Snapshot::lastSnapshotID() {
     else return snapshots.back();
 }
 
+uint32_t Snapshot::lastCompleteSnapshotID() {
+    std::vector<uint32_t> snapshots;
+    getExistingSnapshots(snapshots);
+    snapshot_header_t header;
+    for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it) {
+        if (readHeader(*it, &header) && header.time != 0) return *it;
+        PRINT("Skipping incomplete snapshot %u\n", *it);
+    }
+    return 0;
+}
+
+bool Snapshot::readHeader(uint32_t id, snapshot_header_t *header) {
+    experimental::filesystem::path poolPath = rootPath;
+    poolPath /= "snapshot.";
+    poolPath += std::to_string(id);
+    int snapshotFd = open(poolPath.c_str(), O_RDONLY);
+    if (snapshotFd < 0) return false;
+    ssize_t bytes = pread(snapshotFd, header, sizeof(snapshot_header_t), 0);
+    close(snapshotFd);
+    return bytes == sizeof(snapshot_header_t);
+}
+
+void Snapshot::expiredSnapshots(time_t now, vector<uint32_t> &expired) {
+    const uint64_t retain = Savitar_config()->snapshot_retain;
+    const uint64_t retainTime = Savitar_config()->snapshot_retain_time;
+    if (retain == 0 && retainTime == 0) return;
+    const uint32_t latest = lastCompleteSnapshotID();
+    if (latest == 0) return;
+
+    std::vector<uint32_t> snapshots;
+    getExistingSnapshots(snapshots);
+    std::map<uint32_t, snapshot_header_t> headers;
+    std::set<uint32_t> retained;
+    uint64_t kept = 0;
+    for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it) {
+        snapshot_header_t header;
+        // Newer snapshots are being saved (or were interrupted)
+        if (*it > latest) continue;
+        if (!readHeader(*it, &header) || header.time == 0) {
+            expired.push_back(*it);
+            continue;
+        }
+        headers[*it] = header;
+        bool keep = *it == latest;
+        keep = keep || (retain > 0 && kept < retain);
+        keep = keep || (retainTime > 0 && (uint64_t)(now - header.time) < retainTime);
+        if (!keep) continue;
+        retained.insert(*it);
+        kept++;
+    }
+
+    // Incremental snapshots are restored on top of their bases
+    for (auto it = retained.begin(); it != retained.end(); ++it) {
+        uint32_t id = *it;
+        while (headers.count(id) > 0 &&
+                headers[id].base_identifier != headers[id].identifier) {
+            id = headers[id].base_identifier;
+            retained.insert(id);
+        }
+    }
+    for (auto it = headers.begin(); it != headers.end(); ++it) {
+        if (retained.count(it->first) == 0) expired.push_back(it->first);
+    }
+}
+
+void Snapshot::collectExpired() {
+    vector<uint32_t> expired;
+    expiredSnapshots(time(NULL), expired);
+    if (expired.empty()) return;
+
+    vector<string> paths;
+    for (size_t i = 0; i < expired.size(); i++) {
+        experimental::filesystem::path poolPath = rootPath;
+        poolPath /= "snapshot.";
+        poolPath += std::to_string(expired[i]);
+        paths.push_back(poolPath.string());
+    }
+
+    // Freeing the blocks of large files is slow, off the caller's path
+    waitForCollector();
+    collector = new std::thread([](vector<string> paths) {
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (unlink(paths[i].c_str()) != 0) {
+                PRINT("Unable to delete snapshot %s (%d)\n", paths[i].c_str(),
+                        errno);
+            }
+        }
+        PRINT("Deleted %zu expired snapshot(s)\n", paths.size());
+    }, paths);
+}
+
+void Snapshot::waitForCollector() {
+    if (collector == NULL) return;
+    collector->join();
+    delete collector;
+    collector = NULL;
+}
+
 /*
  * Snapshot layout
- * [header][bitmaps][allocations][data]
+ * [header][bitmaps][allocations][delta map][data]
  */
-void Snapshot::prepareSnapshot() {
+void Snapshot::prepareSnapshot(const char *path) {
     // Calculate snapshot size (excluding data)
     GlobalAlloc *instance = GlobalAlloc::getInstance();
     size_t snapshotSize = sizeof(snapshot_header_t);
@@ -85,11 +225,14 @@ void Snapshot::prepareSnapshot() {
     if (snapshotSize % alignment != 0) {
         snapshotSize += alignment - (snapshotSize % alignment);
     }
+    off_t deltaOffset = snapshotSize;
+    snapshotSize += deltaMapSize();
 
     // Create and map snapshot file
     experimental::filesystem::path poolPath = rootPath;
     poolPath /= "snapshot.";
     poolPath += std::to_string(lastSnapshotID() + 1);
+    if (path != NULL) poolPath = path;
     fd = open(poolPath.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
     assert(fd > 0);
     assert(fallocate(fd, 0, 0, snapshotSize) == 0);
@@ -107,6 +250,11 @@ void Snapshot::prepareSnapshot() {
     view->global_offset = view->bitmap_offset + instance->bitmapSize();
     view->alloc_offset = view->global_offset + instance->snapshotSize();
     view->data_offset = snapshotSize;
+    view->base_identifier = view->identifier; // full snapshot
+    view->saved_blocks = 0;
+    view->delta_offset = deltaOffset;
+    view->flags = 0;
+    view->page_offset = 0;
 
     // Initialize snapshot context
     context = (uint64_t *)malloc(instance->bitmapSize() / 8);
@@ -122,11 +270,17 @@ void Snapshot::waitForFaultHandlers(size_t allocatedBlocks) {
 }
 
 uint32_t Snapshot::create() {
+    // Objects must be recovered before saving them (lazy recovery)
+    NVManager::getInstance().waitForRecovery();
+
     // Block creation of new persistent objects
     NVManager::getInstance().lock();
 
     struct timespec t1, t2, t3;
+    incremental = isIncremental();
+    elidedPages = 0;
     prepareSnapshot();
+    if (incremental) view->base_identifier = trackedSnapshot;
 
     // Extend the snapshot off the critical path
     // Leave some slack for Global Allocator (slack = MinPoolSize)
@@ -145,9 +299,14 @@ uint32_t Snapshot::create() {
     saveAllocationTables();
     markPagesReadOnly();
 
-    // Start the asynchronous stage (begin asynchronous snapshot)
+    /*
+     * Start the asynchronous stage (begin asynchronous snapshot)
+     * The allocation tables are captured, so objects created from now on
+     * are recovered from their logs like objects created after the snapshot
+     */
     clock_gettime(CLOCK_REALTIME, &t2);
     unblockNewTransactions();
+    NVManager::getInstance().unlock();
     saveModifiedPages(allocatedBlocks);
     waitForFaultHandlers(allocatedBlocks);
     _mm_clflush(view);
@@ -155,6 +314,13 @@ uint32_t Snapshot::create() {
 
     // Update snapshot header
     view->time = time(NULL);
+    if (Savitar_config()->incremental_snapshots > 0) {
+        trackedSnapshot = view->identifier;
+        chainLength = incremental ? chainLength + 1 : 0;
+    }
+    PRINT("Snapshot %u: saved %u blocks (base = %u), %zu empty pages\n",
+            view->identifier, view->saved_blocks, view->base_identifier,
+            elidedPages);
 
     // Finalize the snapshot
     uint64_t latency = (t2.tv_sec - t1.tv_sec) * 1E9;
@@ -163,77 +329,97 @@ uint32_t Snapshot::create() {
     latency = (t3.tv_sec - t2.tv_sec) * 1E9;
     latency += (t3.tv_nsec - t2.tv_nsec);
     view->async_latency = latency / 1E3; // us
+    recordSyncLatency(view->sync_latency);
+    _mm_clflush(view); // complete (time)
+    _mm_sfence();
+    uint32_t id = view->identifier;
     cleanEnvironment();
-    NVManager::getInstance().unlock();
 
-    return lastSnapshotID() - 1;
+    return id;
+}
+
+// Snapshots are serialized by the caller (see context.cpp)
+void Snapshot::recordSyncLatency(uint64_t us) {
+    int bucket = us == 0 ? 0 : 63 - __builtin_clzll(us);
+    syncHistogram[bucket]++;
+    syncTotal += us;
+    if (us > syncMax) syncMax = us;
+}
+
+void Savitar_snapshot_stats(SnapshotLatency *stats) {
+    const uint64_t *histogram = Snapshot::syncHistogram;
+    memset(stats, 0, sizeof(SnapshotLatency));
+    for (int b = 0; b < SNAPSHOT_HISTOGRAM_BUCKETS; b++) {
+        stats->snapshots += histogram[b];
+    }
+    stats->total_us = Snapshot::syncTotal;
+    stats->max_us = Snapshot::syncMax;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < SNAPSHOT_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram[b];
+        uint64_t upper_bound = std::min((uint64_t)2 << b, stats->max_us);
+        if (stats->p50_us == 0 && seen * 100 >= stats->snapshots * 50) {
+            stats->p50_us = upper_bound;
+        }
+        if (stats->p99_us == 0 && seen * 100 >= stats->snapshots * 99) {
+            stats->p99_us = upper_bound;
+        }
+    }
 }
 
 void Snapshot::pageFaultHandler(void *addr) {
+    // Not taking a snapshot (e.g., loading one or saving the warm state)
+    if (context == NULL) {
+        assert(trackWrite(addr));
+        return;
+    }
 
     const uintptr_t LB = GlobalAlloc::BaseAddress;
     const uintptr_t UB = GlobalAlloc::BaseAddress + GlobalAlloc::MaxMemorySize;
     uintptr_t alignedAddr = (uintptr_t)addr & ~(FreeList::BlockSize - 1);
     assert(alignedAddr >= LB && alignedAddr < UB);
 
-    const size_t PPBlk = FreeList::BlockSize / GlobalAlloc::BitmapGranularity;
     off_t offset = (alignedAddr - LB) >> 21; // 2 MB pages
 
     if (!CAS(&context[offset], UsedHugePage, LockedHugePage)) {
         // Wait for the other thread who owns the lock
-        while (context[offset] != SavedHugePage) { }
-        return;
-    }
-
-    uint64_t *bitmap = (uint64_t *)((char *)view + view->bitmap_offset);
-    bitmap += offset * PPBlk / 64; // 8 * sizeof(uint64_t)
-    char *src = (char *)alignedAddr;
-    char *dst = (char *)view + view->data_offset + (offset << 21);
-
-    // Copy modified 4 KB pages
-    for (size_t i = 0; i < (PPBlk >> 6); i++) {
-        uint64_t bit = bitmap[i];
-        for (off_t p = 0; p < 64; p++) {
-            if (bit & 0x0000000000000001) {
-                nonTemporalPageCopy(dst, src);
-            }
-            else {
-                nonTemporalCacheLineCopy(dst, src);
-            }
-            src = src + GlobalAlloc::BitmapGranularity;
-            dst = dst + GlobalAlloc::BitmapGranularity;
-            bit = bit >> 1;
+        if (dirtyBlocks == NULL) {
+            while (context[offset] != SavedHugePage) { }
+            return;
         }
+        // Saved blocks stay read-only, or the block is not part of the delta
+        while (context[offset] == LockedHugePage) { }
+        assert(trackWrite(addr));
+        return;
     }
 
-    _mm_sfence();
+    saveBlock(offset);
+    if (dirtyBlocks != NULL) dirtyBlocks[offset] = 1; // for the next snapshot
     assert(mprotect((void *)alignedAddr, FreeList::BlockSize,
                 PROT_READ | PROT_WRITE) == 0);
     assert(CAS(&context[offset], LockedHugePage, SavedHugePage));
 }
 
+/*
+ * Moves to an odd epoch, outer-most transactions that have not published
+ * the current epoch yet block until unblockNewTransactions (one store for
+ * the whole program instead of one per object)
+ */
 void Snapshot::blockNewTransactions() {
-    for (auto it = NVManager::getInstance().objects.begin();
-            it != NVManager::getInstance().objects.end(); it++) {
-        it->second->log->snapshot_lock = 1;
-    }
-    _mm_sfence();
+    NVManager &nvm = NVManager::getInstance();
+    assert((nvm.snapshot_epoch & 1) == 0);
+    __sync_fetch_and_add(&nvm.snapshot_epoch, 1);
 }
 
+// Threads leave the previous epoch when their outer-most transaction commits
 void Snapshot::waitForRunningTransactions() {
-    bool areThereTransactionsRunning = true;
     NVManager &nvm = NVManager::getInstance();
-
-    while (areThereTransactionsRunning) {
-        areThereTransactionsRunning = false;
-        for (auto it = nvm.program_threads.begin();
-                it != nvm.program_threads.end(); it++) {
-            // tx_buffer[0] == number of active transactions
-            if (it->second->tx_buffer[0] != 0) {
-                areThereTransactionsRunning = true;
-                break;
-            }
-        }
+    const uint64_t epoch = nvm.snapshot_epoch - 1;
+    for (auto it = nvm.program_threads.begin();
+            it != nvm.program_threads.end(); it++) {
+        volatile uint64_t *published = &it->second->tx_buffer[TX_BUFFER_EPOCH];
+        while (*published == epoch) _mm_pause();
     }
 }
 
@@ -252,10 +438,14 @@ void Snapshot::saveAllocationTables() {
     for (auto it = NVManager::getInstance().objects.begin();
             it != NVManager::getInstance().objects.end(); it++) {
         ObjectAlloc *alloc = it->second->alloc;
-        *((uint64_t *)snapshot) = it->second->log->last_commit;
+        *((uint64_t *)snapshot) = it->second->control->last_commit;
         snapshot += sizeof(uint64_t);
         *((uint64_t *)snapshot) = it->second->log->tail;
         snapshot += sizeof(uint64_t);
+        // All transactions are complete (quiescent)
+        Savitar_log_watermark(it->second->log, it->second->control->last_commit,
+                it->second->log->tail);
+        it->second->snapshot_tail = it->second->log->tail;
         *((uintptr_t *)snapshot) = (uintptr_t)it->second;
         snapshot += sizeof(uintptr_t);
         alloc->save(snapshot);
@@ -270,6 +460,8 @@ void Snapshot::markPagesReadOnly() {
     GlobalAlloc *instance = GlobalAlloc::getInstance();
     size_t allocatedBlocks = instance->allocatedBlocks();
     uint64_t *bitmap = (uint64_t *)((char *)view + view->bitmap_offset);
+    uint64_t *deltaMap = (uint64_t *)((char *)view + view->delta_offset);
+    const bool tracking = Savitar_config()->incremental_snapshots > 0;
 
     off_t bitmapOffset = 0;
     bool isAllocated;
@@ -286,12 +478,23 @@ void Snapshot::markPagesReadOnly() {
         isAllocated |= bitmap[bitmapOffset++] > 0; // 6
         isAllocated |= bitmap[bitmapOffset++] > 0; // 7
 
-        if (isAllocated) {
+        // Blocks that were not modified are saved in the base snapshots
+        bool isSaved = isAllocated && (!incremental || b >= trackedBlocks ||
+                dirtyBlocks[b] != 0);
+        if (isSaved) {
             context[b] = UsedHugePage;
-            regionSize += FreeList::BlockSize;
+            deltaMap[b >> 6] |= (uint64_t)1 << (b & 63);
+            view->saved_blocks++;
         }
         else {
             context[b] = FreeHugePage;
+        }
+        if (tracking) continue; // the whole heap is protected below
+
+        if (isAllocated) {
+            regionSize += FreeList::BlockSize;
+        }
+        else {
             if (regionSize > 0) {
                 assert(mprotect((void *)addr, regionSize, PROT_READ) == 0);
                 regionSize = 0;
@@ -303,6 +506,19 @@ void Snapshot::markPagesReadOnly() {
     if (regionSize > 0) {
         assert(mprotect((void *)addr, regionSize, PROT_READ) == 0);
     }
+    if (!tracking) return;
+
+    // Start tracking writes for the next snapshot
+    if (dirtyBlocks == NULL) {
+        dirtyBlocks = (volatile uint8_t *)calloc(
+                GlobalAlloc::MaxMemorySize / FreeList::BlockSize, 1);
+    }
+    else {
+        memset((void *)dirtyBlocks, 0, allocatedBlocks);
+    }
+    trackedBlocks = allocatedBlocks;
+    assert(mprotect((void *)GlobalAlloc::BaseAddress,
+                allocatedBlocks * FreeList::BlockSize, PROT_READ) == 0);
 }
 
 void Snapshot::nonTemporalCacheLineCopy(char *dst, char *src) {
@@ -367,81 +583,128 @@ void Snapshot::nonTemporalPageCopy(char *dst, char *src) {
     }
 }
 
-void Snapshot::snapshotWorker(off_t offset, size_t length) {
-
-    GlobalAlloc *ga = GlobalAlloc::getInstance();
-    const size_t BlockSize = FreeList::BlockSize;
-    const size_t PPBlk = BlockSize / ga->BitmapGranularity;
-    const size_t BitmapStepSize = PPBlk / 64; // 8 for 2 MB super-pages
-
-    // Setup data and bitmap pointers
-    char *dst = (char *)view + view->data_offset + offset * BlockSize;
-    char *src = (char *)ga->BaseAddress + offset * BlockSize;
+/*
+ * Copies allocated pages of the block entirely, and the first cache line of
+ * other pages (free region headers). With page holes, pages that would only
+ * copy zeros are left out of the (sparse) file, with a clear page map bit.
+ */
+void Snapshot::saveBlock(off_t block) {
+    const size_t PagesPerBlock = FreeList::BlockSize / GlobalAlloc::BitmapGranularity;
+    const size_t BitmapStepSize = PagesPerBlock / 64; // 8 for 2 MB super-pages
+    char *src = (char *)GlobalAlloc::BaseAddress + block * FreeList::BlockSize;
+    char *dst = (char *)view + view->data_offset + block * FreeList::BlockSize;
     uint64_t *bitmap = (uint64_t *)((char *)view + view->bitmap_offset);
-    bitmap += offset * BitmapStepSize;
+    bitmap += block * BitmapStepSize;
+    uint64_t *pages = NULL;
+    if (view->flags & SnapshotPageHoles) {
+        pages = (uint64_t *)((char *)view + view->page_offset);
+        pages += block * BitmapStepSize;
+    }
 
-    for (off_t sp = 0; sp < length; sp++) {
-        if (CAS(&context[offset + sp], UsedHugePage, LockedHugePage)) {
-
-            // Copy modified 4 KB pages
-            void *oldSrc = src;
-            for (size_t b = 0; b < PPBlk; b += 64) {
-                uint64_t bit = *bitmap;
-                for (off_t p = 0; p < 64; p++) {
-                    if (bit & 0x0000000000000001) {
-                        nonTemporalPageCopy(dst, src);
-                    }
-                    else {
-                        // TODO avoid this by filling unused pages at recovery
-                        nonTemporalCacheLineCopy(dst, src);
-                    }
-                    src = src + GlobalAlloc::BitmapGranularity;
-                    dst = dst + GlobalAlloc::BitmapGranularity;
-                    bit >>= 1;
-                }
-                bitmap++;
+    uint64_t holes = 0;
+    for (size_t i = 0; i < BitmapStepSize; i++) {
+        uint64_t bit = bitmap[i];
+        uint64_t saved = 0;
+        for (off_t p = 0; p < 64; p++) {
+            size_t length = (bit & 1) ? GlobalAlloc::BitmapGranularity : 64;
+            if (pages != NULL && isZero(src, length)) {
+                holes++;
             }
+            else if (bit & 0x0000000000000001) {
+                nonTemporalPageCopy(dst, src);
+                saved |= (uint64_t)1 << p;
+            }
+            else {
+                // TODO avoid this by filling unused pages at recovery
+                nonTemporalCacheLineCopy(dst, src);
+                saved |= (uint64_t)1 << p;
+            }
+            src = src + GlobalAlloc::BitmapGranularity;
+            dst = dst + GlobalAlloc::BitmapGranularity;
+            bit >>= 1;
+        }
+        if (pages != NULL) pages[i] = saved;
+    }
 
-            // Persist changes
-            _mm_sfence();
-
-            assert(mprotect(oldSrc, FreeList::BlockSize,
-                        PROT_READ | PROT_WRITE) == 0);
+    // Persist changes (the page map of a block is one cache line)
+    if (pages != NULL) _mm_clflush(pages);
+    _mm_sfence();
+    if (holes > 0) __sync_fetch_and_add(&elidedPages, holes);
+}
 
-            assert(CAS(&context[offset + sp], LockedHugePage, SavedHugePage));
+bool Snapshot::isZero(const char *src, size_t length) {
+    const uint64_t *word = (const uint64_t *)src;
+    for (size_t i = 0; i < length / sizeof(uint64_t); i += 8) {
+        if (word[i] | word[i + 1] | word[i + 2] | word[i + 3] |
+                word[i + 4] | word[i + 5] | word[i + 6] | word[i + 7]) {
+            return false;
         }
-        else {
-            // Update pointers (skip by one block)
-            src = src + BlockSize;
-            dst = dst + BlockSize;
-            bitmap = bitmap + BitmapStepSize;
+    }
+    return true;
+}
+
+void Snapshot::snapshotWorker(off_t offset, size_t length) {
+    for (off_t sp = 0; sp < length; sp++) {
+        if (!CAS(&context[offset + sp], UsedHugePage, LockedHugePage)) continue;
+        saveBlock(offset + sp);
+
+        // Tracked blocks stay read-only until they are modified again
+        if (dirtyBlocks == NULL) {
+            void *src = (void *)(GlobalAlloc::BaseAddress +
+                    (offset + sp) * FreeList::BlockSize);
+            assert(mprotect(src, FreeList::BlockSize,
+                        PROT_READ | PROT_WRITE) == 0);
         }
+
+        assert(CAS(&context[offset + sp], LockedHugePage, SavedHugePage));
     }
 }
 
 void Snapshot::unblockNewTransactions() {
     NVManager &nvm = NVManager::getInstance();
-    for (auto it = nvm.objects.begin(); it != nvm.objects.end(); it++) {
-        it->second->log->snapshot_lock = 0;
-    }
-    _mm_sfence();
-
     pthread_mutex_lock(nvm.ckptLock());
+    __sync_fetch_and_add(&nvm.snapshot_epoch, 1);
     pthread_cond_broadcast(nvm.ckptCondition());
     pthread_mutex_unlock(nvm.ckptLock());
 }
 
+/*
+ * With page holes, the page map (one bit per page of the data) goes before
+ * the data, which is page-aligned so that holes are holes of the file
+ */
 void Snapshot::extendSnapshot(size_t allocatedBlocks) {
     size_t snapshotSize = view->size;
     size_t dataSize = allocatedBlocks * FreeList::BlockSize;
-    assert(munmap(view, snapshotSize) == 0);
-    assert(fallocate(fd, 0, snapshotSize, dataSize) == 0);
+    const bool holes = Savitar_config()->snapshot_holes;
+    off_t pageOffset = 0;
+    if (holes) {
+        const size_t PageMapStep = FreeList::BlockSize /
+            GlobalAlloc::BitmapGranularity / 8; // 64 bytes per block
+        const size_t PageSize = GlobalAlloc::BitmapGranularity;
+        pageOffset = snapshotSize;
+        snapshotSize += allocatedBlocks * PageMapStep;
+        if (snapshotSize % PageSize != 0) {
+            snapshotSize += PageSize - (snapshotSize % PageSize);
+        }
+    }
+    assert(munmap(view, view->size) == 0);
+    // Incremental snapshots are sparse (only modified blocks are written)
+    if (incremental || holes) {
+        assert(ftruncate(fd, snapshotSize + dataSize) == 0);
+    }
+    else assert(fallocate(fd, 0, snapshotSize, dataSize) == 0);
+    off_t dataOffset = snapshotSize;
     snapshotSize += dataSize;
     // TODO support for huge-pages
     view = (snapshot_header_t *)mmap(NULL, snapshotSize,
             PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     assert(view != NULL);
 
+    view->data_offset = dataOffset;
+    if (holes) {
+        view->flags |= SnapshotPageHoles;
+        view->page_offset = pageOffset;
+    }
     uintptr_t ptr = (uintptr_t)view + view->data_offset;
     ptr = ptr & ~(4096 - 1);
     assert(madvise((void *)ptr, dataSize, MADV_WILLNEED) == 0);
@@ -449,27 +712,52 @@ void Snapshot::extendSnapshot(size_t allocatedBlocks) {
 }
 
 void Snapshot::saveModifiedPages(size_t allocatedBlocks) {
+    runWorkers(allocatedBlocks, workerCount(allocatedBlocks, true),
+            &Snapshot::snapshotWorker);
+}
 
-    // Calculate shares for each snapshot thread
-    assert(allocatedBlocks % SnapshotThreads == 0);
-    size_t shareLength = allocatedBlocks / SnapshotThreads;
+/*
+ * Threads for saving or restoring pages, within the thread budget
+ * Saving is also bounded by the number of NVM writers, as non-temporal
+ * stores saturate the write bandwidth of NVM with a few threads.
+ */
+size_t Snapshot::workerCount(size_t blocks, bool saving) const {
+    size_t workers = Savitar_config()->snapshot_threads;
+    if (workers == 0) workers = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t writers = Savitar_config()->snapshot_writers;
+    if (saving && writers > 0) workers = std::min(workers, writers);
+    size_t chunks = (blocks + ChunkBlocks - 1) / ChunkBlocks;
+    return std::max((size_t)1, std::min(workers, chunks));
+}
 
-    // Start snapshot threads
-    off_t threadIndex = 0;
+/*
+ * Workers take chunks of blocks until all blocks are done, so that workers
+ * that hit free (or clean) blocks take over the work of the others
+ */
+void Snapshot::runWorkers(size_t blocks, size_t workers, BlockWorker worker) {
+    nextChunk = 0;
     vector<std::thread *> threads;
-    for (size_t i = 0; i < SnapshotThreads; i++) {
-        threads.push_back(new thread(&Snapshot::snapshotWorker, this,
-                    threadIndex, shareLength));
-        threadIndex += shareLength;
+    for (size_t i = 0; i < workers; i++) {
+        threads.push_back(new thread(&Snapshot::chunkWorker, this, blocks,
+                    worker));
     }
 
     // Wait for completion
-    for (size_t i = 0; i < SnapshotThreads; i++) {
+    for (size_t i = 0; i < workers; i++) {
         std::thread *thread = threads.back();
         thread->join();
         threads.pop_back();
         delete thread;
     }
+    PRINT("Snapshot: %zu blocks processed by %zu threads\n", blocks, workers);
+}
+
+void Snapshot::chunkWorker(size_t blocks, BlockWorker worker) {
+    while (true) {
+        size_t offset = __sync_fetch_and_add(&nextChunk, ChunkBlocks);
+        if (offset >= blocks) break;
+        (this->*worker)(offset, std::min(ChunkBlocks, blocks - offset));
+    }
 }
 
 void Snapshot::cleanEnvironment() {
@@ -487,19 +775,28 @@ void Snapshot::loadSnapshot(uint32_t id) {
     poolPath /= "snapshot.";
     poolPath += std::to_string(id);
     PRINT("Loading from snapshot: %s\n", poolPath.c_str());
-    fd = open(poolPath.c_str(), O_RDONLY, 0666);
-    assert(fd > 0);
+    mapSnapshot(poolPath.c_str());
+}
 
-    view = (snapshot_header_t *)mmap(NULL, sizeof(snapshot_header_t),
-            PROT_READ, MAP_SHARED, fd, 0);
-    assert(view != NULL);
-    size_t snapshotSize = view->size;
-    munmap(view, sizeof(snapshot_header_t));
+void Snapshot::mapSnapshot(const char *path) {
+    view = mapReadOnly(path, &fd);
+}
 
-    view = (snapshot_header_t *)mmap(NULL, snapshotSize,
-            PROT_READ, MAP_SHARED, fd, 0);
-    assert(view != NULL);
-    PRINT("Mapped snapshot: %zu bytes at %p\n", snapshotSize, view);
+snapshot_header_t *Snapshot::mapReadOnly(const char *path, int *fd) {
+    *fd = open(path, O_RDONLY, 0666);
+    assert(*fd > 0);
+
+    snapshot_header_t *header = (snapshot_header_t *)mmap(NULL,
+            sizeof(snapshot_header_t), PROT_READ, MAP_SHARED, *fd, 0);
+    assert(header != NULL);
+    size_t snapshotSize = header->size;
+    munmap(header, sizeof(snapshot_header_t));
+
+    header = (snapshot_header_t *)mmap(NULL, snapshotSize,
+            PROT_READ, MAP_SHARED, *fd, 0);
+    assert(header != NULL);
+    PRINT("Mapped snapshot: %zu bytes at %p\n", snapshotSize, header);
+    return header;
 }
 
 // TODO merge the following with snapshotWorker
@@ -509,77 +806,153 @@ void Snapshot::restoreWorker(off_t offset, size_t length) {
     const size_t PagesPerBlock = FreeList::BlockSize / ga->BitmapGranularity;
     const size_t BitmapStepSize = PagesPerBlock / 64;
 
-    char *src = (char *)view + view->data_offset + offset * FreeList::BlockSize;
     char *dst = (char *)(ga->BaseAddress + offset * FreeList::BlockSize);
     uint64_t *bitmap = (uint64_t *)((char *)view + view->bitmap_offset);
     bitmap += offset * BitmapStepSize;
 
     for (size_t sp = 0; sp < length; sp++) {
-        // Skip over unused super-pages (blocks)
-        if (bitmap[0] == 0 && bitmap[1] == 0 &&
+        // Skip over unused super-pages (blocks), or blocks in no snapshot
+        char *src = (char *)blockSources[offset + sp];
+        if (src == NULL || (bitmap[0] == 0 && bitmap[1] == 0 &&
             bitmap[2] == 0 && bitmap[3] == 0 &&
             bitmap[4] == 0 && bitmap[5] == 0 &&
-            bitmap[6] == 0 && bitmap[7] == 0) {
+            bitmap[6] == 0 && bitmap[7] == 0)) {
 
             bitmap += 8;
-            src = src + FreeList::BlockSize;
             dst = dst + FreeList::BlockSize;
             continue;
         }
 
+        // Holes are zero in the heap, which is mapped before restoring it
+        const uint64_t *pages = blockPages[offset + sp];
         for (size_t b = 0; b < PagesPerBlock; b += 64) {
             uint64_t bit = *bitmap;
+            uint64_t saved = pages != NULL ? pages[b >> 6] : UINT64_MAX;
             for (off_t p = 0; p < 64; p++) {
-                if (bit & 0x0000000000000001) {
+                if ((saved & 0x0000000000000001) && (bit & 0x0000000000000001)) {
                     nonTemporalPageCopy(dst, src);
                 }
-                else {
+                else if (saved & 0x0000000000000001) {
                     nonTemporalCacheLineCopy(dst, src);
                 }
                 src = src + GlobalAlloc::BitmapGranularity;
                 dst = dst + GlobalAlloc::BitmapGranularity;
                 bit >>= 1;
+                saved >>= 1;
             }
             bitmap++;
         }
     }
 }
 
+/*
+ * Copies the newest saved copy of each block, from the loaded snapshot back
+ * to its full base snapshot, using the bitmap of the loaded snapshot
+ */
+void Snapshot::restorePages(size_t blocks) {
+    const size_t BlockSize = FreeList::BlockSize;
+    blockSources.assign(blocks, NULL);
+    blockPages.assign(blocks, NULL);
+    vector< pair<int, snapshot_header_t *> > bases;
+    snapshot_header_t *header = view;
+    while (true) {
+        const uint64_t *deltaMap = (const uint64_t *)((char *)header +
+                header->delta_offset);
+        const char *data = (const char *)header + header->data_offset;
+        size_t dataBlocks = (header->size - header->data_offset) / BlockSize;
+        const uint64_t *pages = NULL;
+        if (header->flags & SnapshotPageHoles) {
+            pages = (const uint64_t *)((char *)header + header->page_offset);
+        }
+        for (size_t b = 0; b < blocks && b < dataBlocks; b++) {
+            if (blockSources[b] == NULL && (deltaMap[b >> 6] >> (b & 63)) & 1) {
+                blockSources[b] = data + b * BlockSize;
+                if (pages != NULL) blockPages[b] = pages + b * 8;
+            }
+        }
+        if (header->base_identifier == header->identifier) break;
+
+        experimental::filesystem::path basePath = rootPath;
+        basePath /= "snapshot.";
+        basePath += std::to_string(header->base_identifier);
+        PRINT("Loading base snapshot: %s\n", basePath.c_str());
+        int baseFd;
+        header = mapReadOnly(basePath.c_str(), &baseFd);
+        bases.push_back(pair<int, snapshot_header_t *>(baseFd, header));
+    }
+
+    runWorkers(blocks, workerCount(blocks, false), &Snapshot::restoreWorker);
+
+    for (size_t i = 0; i < bases.size(); i++) {
+        munmap(bases[i].second, bases[i].second->size);
+        close(bases[i].first);
+    }
+    blockSources.clear();
+    blockPages.clear();
+}
+
 void Snapshot::load(uint32_t id, NVManager *manager) {
 
+    RecoveryReport &report = RecoveryReport::getInstance();
+    uint64_t phaseStart = RecoveryReport::now();
     loadSnapshot(id);
+    report.addPhase(PhaseSnapshotMap, RecoveryReport::now() - phaseStart);
 
     // Global allocator and the bitmap
     const char *bitmap = (const char *)((char *)view + view->bitmap_offset);
     const char *gaCkpt = (const char *)((char *)view + view->global_offset);
-    GlobalAlloc *ga = new GlobalAlloc(gaCkpt, bitmap);
+    SnapshotRestore *restore = NULL;
+    const bool isDelta = view->base_identifier != view->identifier;
+    if (Savitar_config()->restore_mode == RestoreLazy && isDelta) {
+        PRINT("Incremental snapshot, restoring pages eagerly\n");
+    }
+    else if (Savitar_config()->restore_mode == RestoreLazy) {
+        restore = SnapshotRestore::create();
+    }
+    GlobalAlloc *ga = new GlobalAlloc(gaCkpt, bitmap, restore == NULL);
 
     // Data
     const char *data = (const char *)((char *)view + view->data_offset);
     size_t dataSize = view->size - (size_t)view->data_offset;
 
-    // TODO replace this with on-demand paging using userfaultfd(2)
-    // Start restore threads
-    size_t shareLength = ga->allocatedBlocks() / SnapshotThreads;
-    off_t threadIndex = 0;
-    vector<std::thread *> threads;
-    for (size_t i = 0; i < SnapshotThreads; i++) {
-        threads.push_back(new thread(&Snapshot::restoreWorker, this,
-                    threadIndex, shareLength));
-        threadIndex += shareLength;
+    // Restore pages on demand, or copy all pages if userfaultfd fails
+    if (restore != NULL && !restore->start(fd, view, view->size, data,
+                dataSize, (const uint64_t *)bitmap, ga->blockOwners(),
+                ga->allocatedBlocks(),
+                workerCount(ga->allocatedBlocks(), false))) {
+        delete restore;
+        restore = NULL;
     }
 
-    // Wait for completion
-    for (size_t i = 0; i < SnapshotThreads; i++) {
-        std::thread *thread = threads.back();
-        thread->join();
-        threads.pop_back();
-        delete thread;
+    if (restore == NULL) {
+        phaseStart = RecoveryReport::now();
+        restorePages(ga->allocatedBlocks());
+        PRINT("Finished restoring pages from snapshot\n");
+
+        size_t usedBlocks = 0;
+        const uint64_t *b = (const uint64_t *)bitmap;
+        for (size_t i = 0; i < ga->allocatedBlocks(); i++, b += 8) {
+            if (b[0] | b[1] | b[2] | b[3] | b[4] | b[5] | b[6] | b[7]) {
+                usedBlocks++;
+            }
+        }
+        report.addPhase(PhasePageRestore, RecoveryReport::now() - phaseStart);
+        report.setPageRestore(usedBlocks * FreeList::BlockSize, false, 0, 0, 0);
     }
-    PRINT("Finished restoring pages from snapshot\n");
+    phaseStart = RecoveryReport::now();
+    restoreAllocators(ga, manager);
+    report.addPhase(PhaseAllocatorRestore, RecoveryReport::now() - phaseStart);
+    if (restore == NULL) cleanEnvironment();
+    else { // released by SnapshotRestore once all pages are restored
+        view = NULL;
+        fd = 0;
+    }
+}
 
+void Snapshot::restoreAllocators(GlobalAlloc *ga, NVManager *manager) {
     // Persistent objects and allocators
     std::map<std::string, uint64_t> lastCommitIDs;
+    std::map<std::string, uint32_t> logHeadSlots;
     char *objCkpt = (char *)view + view->alloc_offset;
     for (uint32_t i = 0; i < view->object_count; i++) {
         uint64_t lastCommit = *((uint64_t *)objCkpt);
@@ -604,7 +977,8 @@ void Snapshot::load(uint32_t id, NVManager *manager) {
             manager->objects.insert(pair<string, PersistentObject *>(
                         uuid_str, (PersistentObject *)objectPtr));
             lastCommitIDs.insert(pair<string, uint64_t>(uuid_str, lastCommit));
-            RecoveryContext::getInstance().pushLogHeadOffset(uuid_str, logTail);
+            logHeadSlots.insert(pair<string, uint32_t>(uuid_str,
+                        RecoveryContext::getInstance().addLogHeadOffset(logTail)));
         }
     }
     PRINT("Finished restoring allocators for %d object(s)\n", view->object_count);
@@ -623,15 +997,92 @@ void Snapshot::load(uint32_t id, NVManager *manager) {
         alloc->releaseFreeBlocks();
         objCkpt += alloc->snapshotSize();
     }
-
-    cleanEnvironment();
     if (manager == NULL) return;
 
-    // Reset last played commit IDs
+    // Reset last played commit IDs and log head slots
     for (auto it = manager->objects.begin();
             it != manager->objects.end(); it++) {
         assert(lastCommitIDs.find(it->first) != lastCommitIDs.end());
         uint64_t commitID = lastCommitIDs.find(it->first)->second;
         it->second->last_played_commit_id = commitID;
+        it->second->log_head_slot = logHeadSlots.find(it->first)->second;
     }
 }
+
+void Snapshot::saveWarmState() {
+    NVManager::getInstance().lock();
+    dropWarmState();
+    prepareSnapshot(warmPath.c_str());
+
+    // Quiescent, the heap is not copied (it is the warm state)
+    blockNewTransactions();
+    waitForRunningTransactions();
+    saveAllocationTables();
+    uuid_generate(view->heap_generation);
+    view->heap_size = GlobalAlloc::stampHeapFile(view->heap_generation);
+    view->time = time(NULL);
+    int ret = msync(view, view->size, MS_SYNC);
+    assert(ret == 0);
+    unblockNewTransactions();
+
+    PRINT("Saved warm state: %u object(s)\n", view->object_count);
+    cleanEnvironment();
+    NVManager::getInstance().unlock();
+}
+
+bool Snapshot::hasWarmState(size_t objects, uuid_t generation,
+        size_t *heap_size) {
+    if (!experimental::filesystem::exists(warmPath)) return false;
+    mapSnapshot(warmPath.c_str());
+
+    // Incomplete (crash while saving) or out of sync with the catalog
+    bool valid = view->time != 0 && view->object_count == objects;
+
+    // Logs must not have changed since (i.e., no cold start in between)
+    char *objCkpt = (char *)view + view->alloc_offset;
+    for (uint32_t i = 0; valid && i < view->object_count; i++) {
+        uint64_t lastCommit = ((uint64_t *)objCkpt)[0];
+        uint64_t logTail = ((uint64_t *)objCkpt)[1];
+        objCkpt += 2 * sizeof(uint64_t) + sizeof(uintptr_t);
+
+        uuid_t uuid;
+        memcpy(uuid, objCkpt, sizeof(uuid_t));
+        SavitarLog log;
+        valid = Savitar_log_read_header(uuid, &log) && log.tail == logTail &&
+            log.watermark_commit == lastCommit;
+
+        // Object allocator: uuid, cores, allocator pointer, free lists
+        uint64_t cores = ((uint64_t *)objCkpt)[2];
+        objCkpt += 4 * sizeof(uint64_t) + cores * FreeList::snapshotSize();
+    }
+
+    uuid_copy(generation, view->heap_generation);
+    *heap_size = view->heap_size;
+    PRINT("Warm state is %s\n", valid ? "valid" : "stale");
+    cleanEnvironment();
+    return valid;
+}
+
+void Snapshot::loadWarm(NVManager *manager) {
+    RecoveryReport &report = RecoveryReport::getInstance();
+    uint64_t phaseStart = RecoveryReport::now();
+    PRINT("Loading from warm state: %s\n", warmPath.c_str());
+    mapSnapshot(warmPath.c_str());
+    dropWarmState(); // the heap is modified from now on
+    report.addPhase(PhaseSnapshotMap, RecoveryReport::now() - phaseStart);
+
+    // The heap file already holds the pages
+    const char *bitmap = (const char *)((char *)view + view->bitmap_offset);
+    const char *gaCkpt = (const char *)((char *)view + view->global_offset);
+    GlobalAlloc *ga = new GlobalAlloc(gaCkpt, bitmap, false);
+    report.setPageRestore(0, false, 0, 0, 0);
+
+    phaseStart = RecoveryReport::now();
+    restoreAllocators(ga, manager);
+    report.addPhase(PhaseAllocatorRestore, RecoveryReport::now() - phaseStart);
+    cleanEnvironment();
+}
+
+void Snapshot::dropWarmState() {
+    unlink(warmPath.c_str());
+}
@@ -2,13 +2,24 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <uuid/uuid.h>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <experimental/filesystem>
 
+#define SNAPSHOT_HISTOGRAM_BUCKETS  32 // log2(us)
+
 using namespace std;
 class NVManager;
+class GlobalAlloc;
+struct SnapshotLatency;
 
+/*
+ * Incremental snapshots only save the blocks modified since their base
+ * snapshot (base_identifier), a full snapshot is its own base. The delta
+ * map has one bit per block of the heap, set for blocks saved in the file.
+ */
 typedef struct {
     uint32_t identifier;
     uint32_t object_count;
@@ -20,8 +31,22 @@ typedef struct {
     off_t global_offset;
     off_t alloc_offset;
     off_t data_offset;
+    uint32_t base_identifier;
+    uint32_t saved_blocks;
+    off_t delta_offset;
+    uint64_t flags;
+    off_t page_offset; // page map (SnapshotPageHoles)
+    uuid_t heap_generation; // warm state (see GlobalAlloc::openHeapFile)
+    uint64_t heap_size;
+    uint64_t reserved[1];
 } snapshot_header_t;
 
+/*
+ * The data has holes for pages that only hold zeros or were never allocated,
+ * and the page map has one bit per page of the data, set for saved pages
+ */
+#define SnapshotPageHoles           0x1
+
 namespace {
     class SnapshotTestSuite;
 }
@@ -33,43 +58,106 @@ public:
     static Snapshot *getInstance();
     static bool anyActiveSnapshot();
     uint32_t create();
+    typedef void (Snapshot::*BlockWorker)(off_t, size_t);
     void snapshotWorker(off_t, size_t);
     void restoreWorker(off_t, size_t);
     void load(uint32_t id = 0, NVManager *manager = NULL);
+
+    /*
+     * Warm restart (see GlobalAlloc::openHeapFile)
+     * The warm state is a snapshot without data, saved on clean shutdown
+     * when the heap is a file that outlives the process. It is only valid
+     * if no log was modified after it was saved, and only for the heap file
+     * with the same generation and size (checked when opening the file).
+     */
+    void saveWarmState();
+    bool hasWarmState(size_t objects, uuid_t generation, size_t *heap_size);
+    void loadWarm(NVManager *manager);
+    void dropWarmState();
     void pageFaultHandler(void *);
     uint32_t lastSnapshotID();
+    // Latest snapshot that was completely saved (0 if none)
+    uint32_t lastCompleteSnapshotID();
+
+    /*
+     * Retention (PRONTO_SNAPSHOT_RETAIN and PRONTO_SNAPSHOT_RETAIN_TIME)
+     * Called once the latest snapshot is complete and the logs have been
+     * truncated against it (if they are). Snapshots that are no longer
+     * retained are deleted by a background thread, incomplete snapshots
+     * older than the latest complete one are deleted as well.
+     */
+    void collectExpired();
+    void expiredSnapshots(time_t now, vector<uint32_t> &);
+    static void waitForCollector();
+
+    /*
+     * Dirty tracking for incremental snapshots (PRONTO_INCREMENTAL_SNAPSHOTS)
+     * Once a snapshot is taken, the heap stays read-only and the first write
+     * to each block marks it dirty (SIGSEGV), so that the next snapshot only
+     * saves dirty blocks. Returns false if the address is not tracked.
+     */
+    static bool trackWrite(void *);
+    static size_t deltaMapSize();
 
 protected:
     void loadSnapshot(uint32_t);
-    void prepareSnapshot();
+    void mapSnapshot(const char *);
+    static snapshot_header_t *mapReadOnly(const char *, int *);
+    bool readHeader(uint32_t, snapshot_header_t *);
+    void restoreAllocators(GlobalAlloc *, NVManager *);
+    void prepareSnapshot(const char *path = NULL);
     void blockNewTransactions();
     void unblockNewTransactions();
     void waitForRunningTransactions();
     void saveAllocationTables();
     void extendSnapshot(size_t);
     void saveModifiedPages(size_t);
+    void saveBlock(off_t);
+    static bool isZero(const char *, size_t);
+    size_t workerCount(size_t, bool) const;
+    void runWorkers(size_t, size_t, BlockWorker);
+    void chunkWorker(size_t, BlockWorker);
     void cleanEnvironment();
     void markPagesReadOnly();
+    void restorePages(size_t);
+    bool isIncremental();
     void nonTemporalPageCopy(char *, char *);
     void nonTemporalCacheLineCopy(char *, char *);
     void getExistingSnapshots(std::vector<uint32_t>&);
     void waitForFaultHandlers(size_t);
+    static void recordSyncLatency(uint64_t);
 
 private:
     static Snapshot *instance;
+    static volatile uint8_t *dirtyBlocks;
+    static size_t trackedBlocks; // blocks read-only since the last snapshot
+    static uint32_t trackedSnapshot; // last snapshot of this process
+    static uint32_t chainLength; // incremental snapshots since the full one
+    // Synchronous stage of the snapshots of this process (log2 us buckets)
+    static uint64_t syncHistogram[SNAPSHOT_HISTOGRAM_BUCKETS];
+    static uint64_t syncTotal;
+    static uint64_t syncMax;
+    static std::thread *collector; // deletes expired snapshots
+    bool incremental = false;
+    vector<const char *> blockSources; // restore (newest copy of each block)
+    vector<const uint64_t *> blockPages; // page map of each block (or NULL)
+    volatile uint64_t elidedPages = 0; // holes of the snapshot being saved
+    volatile uint64_t nextChunk = 0;
     experimental::filesystem::path rootPath;
+    experimental::filesystem::path warmPath;
     int fd;
     snapshot_header_t *view;
     uint64_t *context;
 
     friend class ::SnapshotTestSuite;
+    friend void Savitar_snapshot_stats(SnapshotLatency *);
 
 public:
-    const size_t SnapshotThreads = 4;
+    static const size_t ChunkBlocks = 8; // 16 MB, unit of work of threads
     const uint64_t UsedHugePage = 0xAAAAAAAAAAAAAAAA;
     const uint64_t FreeHugePage = 0xFFFFFFFFFFFFFFFF;
     const uint64_t LockedHugePage = 0xAFAFAFAFAFAFAFAF;
     const uint64_t SavedHugePage = 0x0000000000000000;
-    static_assert(sizeof(snapshot_header_t) == 64,
+    static_assert(sizeof(snapshot_header_t) % 64 == 0,
             "Snapshot header is not cache-aligned!");
 };
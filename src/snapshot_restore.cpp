@@ -0,0 +1,313 @@
+#include "snapshot_restore.hpp"
+#include "ckpt_alloc.hpp"
+#include "savitar.hpp"
+#include "recovery_report.hpp"
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAS(a,b,c) __sync_bool_compare_and_swap(a,b,c)
+
+SnapshotRestore *SnapshotRestore::active = NULL;
+pthread_mutex_t SnapshotRestore::activeLock = PTHREAD_MUTEX_INITIALIZER;
+
+SnapshotRestore *SnapshotRestore::create() {
+    int uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (uffd < 0) {
+        PRINT("Snapshot restore: userfaultfd is not available (%d)\n", errno);
+        return NULL;
+    }
+
+    struct uffdio_api api;
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    if (ioctl(uffd, UFFDIO_API, &api) != 0) {
+        PRINT("Snapshot restore: unsupported userfaultfd API (%d)\n", errno);
+        close(uffd);
+        return NULL;
+    }
+    return new SnapshotRestore(uffd);
+}
+
+SnapshotRestore::SnapshotRestore(int uffd) : uffd(uffd) { }
+
+SnapshotRestore::~SnapshotRestore() {
+    assert(handler == NULL);
+    if (view != NULL) munmap(view, viewSize);
+    if (fd > 0) close(fd);
+    if (stopfd >= 0) close(stopfd);
+    close(uffd);
+    free((void *)blockStates);
+    free(zeroBlock);
+}
+
+bool SnapshotRestore::start(int fd, void *view, size_t viewSize,
+        const char *data, size_t dataSize, const uint64_t *bitmap,
+        const uint16_t *owners, size_t blocks, size_t prefetchThreads) {
+
+    const size_t BlockSize = FreeList::BlockSize;
+    struct uffdio_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = GlobalAlloc::BaseAddress;
+    reg.range.len = blocks * BlockSize;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (ioctl(uffd, UFFDIO_REGISTER, &reg) != 0) {
+        PRINT("Snapshot restore: unable to register the heap (%d)\n", errno);
+        return false;
+    }
+    if ((reg.ioctls & ((uint64_t)1 << _UFFDIO_COPY)) == 0) {
+        PRINT("Snapshot restore: UFFDIO_COPY is not supported for the heap\n");
+        int ret = ioctl(uffd, UFFDIO_UNREGISTER, &reg.range);
+        assert(ret == 0);
+        return false;
+    }
+
+    this->fd = fd;
+    this->view = view;
+    this->viewSize = viewSize;
+    this->data = data;
+    this->dataSize = dataSize;
+    this->bitmap = bitmap;
+    this->blocks = blocks;
+    blockStates = (volatile uint64_t *)calloc(blocks, sizeof(uint64_t));
+    for (size_t b = 0; b < blocks; b++) {
+        if (owners[b] != 0 && isUsed(b)) ownedBlocks[owners[b]].push_back(b);
+    }
+    int ret = posix_memalign((void **)&zeroBlock, BlockSize, BlockSize);
+    assert(ret == 0);
+    memset(zeroBlock, 0, BlockSize);
+    stopfd = eventfd(0, EFD_CLOEXEC);
+    assert(stopfd >= 0);
+    startTime = RecoveryReport::now();
+    RecoveryReport::getInstance().beginPart();
+
+    pthread_mutex_lock(&activeLock);
+    assert(active == NULL);
+    active = this;
+    pthread_mutex_unlock(&activeLock);
+
+    handler = new std::thread(&SnapshotRestore::faultHandler, this);
+    coordinator = new std::thread(&SnapshotRestore::finish, this,
+            prefetchThreads);
+    PRINT("Snapshot restore: restoring %zu blocks on demand\n", blocks);
+    return true;
+}
+
+void SnapshotRestore::wait() {
+    pthread_mutex_lock(&activeLock);
+    if (active != NULL) {
+        active->coordinator->join();
+        while (active->users > 0) sched_yield();
+        delete active->coordinator;
+        delete active;
+        active = NULL;
+    }
+    pthread_mutex_unlock(&activeLock);
+}
+
+void SnapshotRestore::restoreObject(const ObjectAlloc *alloc) {
+    uint16_t owner = GlobalAlloc::getInstance()->allocatorSlot(alloc);
+    if (owner == 0) return;
+
+    pthread_mutex_lock(&activeLock);
+    SnapshotRestore *restore = active;
+    if (restore != NULL && !restore->finished) {
+        __sync_fetch_and_add(&restore->users, 1);
+    }
+    else restore = NULL;
+    pthread_mutex_unlock(&activeLock);
+    if (restore == NULL) return;
+
+    restore->restoreBlocks(owner);
+    __sync_fetch_and_sub(&restore->users, 1);
+}
+
+void SnapshotRestore::restoreBlocks(uint16_t owner) {
+    auto it = ownedBlocks.find(owner);
+    if (it == ownedBlocks.end()) return;
+
+    char *buffer = NULL;
+    int ret = posix_memalign((void **)&buffer, GlobalAlloc::BitmapGranularity,
+            FreeList::BlockSize);
+    assert(ret == 0);
+    size_t restored = 0;
+    for (size_t i = 0; i < it->second.size(); i++) {
+        if (restoreBlock(it->second[i], buffer)) restored++;
+    }
+    free(buffer);
+    __sync_fetch_and_add(&objectBlocks, restored);
+}
+
+bool SnapshotRestore::isUsed(size_t block) const {
+    const size_t BitmapStepSize =
+        FreeList::BlockSize / GlobalAlloc::BitmapGranularity / 64;
+    const uint64_t *b = bitmap + block * BitmapStepSize;
+    for (size_t i = 0; i < BitmapStepSize; i++) {
+        if (b[i] != 0) return true;
+    }
+    return false;
+}
+
+/*
+ * Copies the block into the heap, returns false if another thread did
+ * UFFDIO_COPY wakes up threads waiting for the block, including faults
+ * read by the handler while the block was locked by a prefetch thread.
+ */
+bool SnapshotRestore::restoreBlock(size_t block, char *buffer) {
+    const size_t BlockSize = FreeList::BlockSize;
+    if (!CAS(&blockStates[block], PendingBlock, LockedBlock)) return false;
+
+    const bool used = isUsed(block);
+    const char *src = zeroBlock;
+    if (used) {
+        assert((block + 1) * BlockSize <= dataSize);
+        src = data + block * BlockSize;
+        // UFFDIO_COPY requires a page-aligned source
+        if ((uintptr_t)src % GlobalAlloc::BitmapGranularity != 0) {
+            memcpy(buffer, src, BlockSize);
+            src = buffer;
+        }
+    }
+
+    struct uffdio_copy copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.dst = GlobalAlloc::BaseAddress + block * BlockSize;
+    copy.src = (uintptr_t)src;
+    copy.len = BlockSize;
+    int ret = ioctl(uffd, UFFDIO_COPY, &copy);
+    if (ret != 0 && errno == ENOENT) {
+        // Unused block faulted while the heap is unregistered (finish)
+        assert(finished && !used);
+    }
+    else if (ret != 0) {
+        /*
+         * The block was populated before the heap was registered (i.e., the
+         * free list written by GlobalAlloc::load), overwrite it like eager
+         * restore does for used blocks
+         */
+        assert(errno == EEXIST);
+        if (used) memcpy((void *)copy.dst, src, BlockSize);
+        struct uffdio_range range = { .start = copy.dst, .len = BlockSize };
+        ioctl(uffd, UFFDIO_WAKE, &range);
+    }
+    if (used) __sync_fetch_and_add(&restoredBytes, BlockSize);
+    bool unlocked = CAS(&blockStates[block], LockedBlock, RestoredBlock);
+    assert(unlocked);
+    return true;
+}
+
+void SnapshotRestore::faultHandler() {
+    char *buffer = NULL;
+    int ret = posix_memalign((void **)&buffer, GlobalAlloc::BitmapGranularity,
+            FreeList::BlockSize);
+    assert(ret == 0);
+
+    struct pollfd fds[2];
+    fds[0].fd = uffd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopfd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            assert(errno == EINTR);
+            continue;
+        }
+        if (fds[1].revents & POLLIN) break;
+
+        struct uffd_msg msg;
+        ssize_t bytes = read(uffd, &msg, sizeof(msg));
+        if (bytes != sizeof(msg)) {
+            assert(bytes < 0 && errno == EAGAIN);
+            continue;
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT) continue;
+
+        uintptr_t addr = msg.arg.pagefault.address;
+        size_t block = (addr - GlobalAlloc::BaseAddress) / FreeList::BlockSize;
+        assert(block < blocks);
+        if (restoreBlock(block, buffer)) {
+            __sync_fetch_and_add(&faultedBlocks, 1);
+        }
+    }
+    free(buffer);
+}
+
+// Used blocks are prefetched in the order of the allocation bitmap
+void SnapshotRestore::prefetchWorker() {
+    char *buffer = NULL;
+    int ret = posix_memalign((void **)&buffer, GlobalAlloc::BitmapGranularity,
+            FreeList::BlockSize);
+    assert(ret == 0);
+
+    while (true) {
+        size_t block = __sync_fetch_and_add(&nextBlock, 1);
+        if (block >= blocks) break;
+        if (!isUsed(block)) continue;
+        if (restoreBlock(block, buffer)) {
+            __sync_fetch_and_add(&prefetchedBlocks, 1);
+        }
+    }
+    free(buffer);
+}
+
+void SnapshotRestore::finish(size_t prefetchThreads) {
+    vector<std::thread *> threads;
+    for (size_t i = 0; i < prefetchThreads; i++) {
+        threads.push_back(new thread(&SnapshotRestore::prefetchWorker, this));
+    }
+    for (size_t i = 0; i < prefetchThreads; i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    // Blocks locked by other threads (faults or objects) are still copying
+    for (size_t b = 0; b < blocks; b++) {
+        while (blockStates[b] == LockedBlock) sched_yield();
+    }
+    finished = true;
+
+    /*
+     * All used blocks are restored, unused blocks are zero-filled by the
+     * kernel from now on (unregistering wakes up any pending faults)
+     */
+    struct uffdio_range range;
+    range.start = GlobalAlloc::BaseAddress;
+    range.len = blocks * FreeList::BlockSize;
+    int ret = ioctl(uffd, UFFDIO_UNREGISTER, &range);
+    assert(ret == 0);
+
+    uint64_t stop = 1;
+    ssize_t bytes = write(stopfd, &stop, sizeof(stop));
+    assert(bytes == sizeof(stop));
+    handler->join();
+    delete handler;
+    handler = NULL;
+
+    if (view != NULL) munmap(view, viewSize);
+    if (fd > 0) close(fd);
+    view = NULL;
+    fd = 0;
+
+    uint64_t restoreTime = RecoveryReport::now() - startTime;
+    PRINT("Snapshot restore: %zu blocks on fault, %zu by objects, "
+            "%zu prefetched in %.2f ms\n", faultedBlocks, objectBlocks,
+            prefetchedBlocks, (double)restoreTime / 1E6);
+
+    RecoveryReport &report = RecoveryReport::getInstance();
+    report.addPhase(PhasePageRestore, restoreTime);
+    report.setPageRestore(restoredBytes, true, faultedBlocks, objectBlocks,
+            prefetchedBlocks);
+    report.endPart();
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <thread>
+#include <vector>
+
+using namespace std;
+class ObjectAlloc;
+
+/*
+ * On-demand restore of the heap from a snapshot, using userfaultfd(2)
+ * * The heap is mapped without populating it and registered for missing
+ *   page faults, so that recovery can start before any page is restored.
+ * * Faults are served by a handler thread, which copies the faulting 2 MB
+ *   block from the mapped snapshot (unused blocks are zero-filled).
+ * * Recovery threads restore the blocks owned by an object (i.e., its
+ *   allocator) before replaying its log, so replay of restored objects
+ *   overlaps with restoring the blocks of other objects.
+ * * Prefetch threads restore the remaining used blocks in the order of the
+ *   allocation bitmap, then the heap is unregistered and the snapshot is
+ *   unmapped.
+ */
+class SnapshotRestore {
+public:
+    // Returns NULL if userfaultfd is not available (restore eagerly)
+    static SnapshotRestore *create();
+    ~SnapshotRestore();
+
+    /*
+     * Registers the first `blocks` blocks of the heap and starts the restore
+     * On success, the restore takes ownership of the snapshot (fd and view)
+     * and the caller must not access the heap before start() returns.
+     */
+    bool start(int fd, void *view, size_t viewSize, const char *data,
+            size_t dataSize, const uint64_t *bitmap, const uint16_t *owners,
+            size_t blocks, size_t prefetchThreads);
+
+    // Waits for the active restore (if any) to finish
+    static void wait();
+
+    // Restores the blocks owned by the allocator in the calling thread
+    static void restoreObject(const ObjectAlloc *);
+
+private:
+    SnapshotRestore(int);
+    bool isUsed(size_t) const;
+    bool restoreBlock(size_t, char *);
+    void restoreBlocks(uint16_t);
+    void faultHandler();
+    void prefetchWorker();
+    void finish(size_t);
+
+    static SnapshotRestore *active;
+    static pthread_mutex_t activeLock;
+
+    int uffd;
+    int stopfd = -1;
+    int fd = 0;
+    void *view = NULL;
+    size_t viewSize = 0;
+    const char *data = NULL;
+    size_t dataSize = 0;
+    const uint64_t *bitmap = NULL;
+    size_t blocks = 0;
+    volatile uint64_t *blockStates = NULL;
+    volatile uint64_t nextBlock = 0;
+    map<uint16_t, vector<size_t>> ownedBlocks; // used blocks by owner
+    volatile uint64_t users = 0; // threads in restoreObject()
+    volatile bool finished = false;
+    char *zeroBlock = NULL;
+    std::thread *handler = NULL;
+    std::thread *coordinator = NULL;
+
+    // Statistics
+    uint64_t startTime = 0;
+    volatile uint64_t restoredBytes = 0;
+    volatile uint64_t faultedBlocks = 0;
+    volatile uint64_t prefetchedBlocks = 0;
+    volatile uint64_t objectBlocks = 0;
+
+public:
+    const uint64_t PendingBlock = 0;
+    const uint64_t LockedBlock = 1;
+    const uint64_t RestoredBlock = 2;
+};
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include "snapshot_scheduler.hpp"
+#include "recovery_report.hpp"
+#include "savitar.hpp"
+
+SnapshotScheduler *SnapshotScheduler::create() {
+    SavitarConfig *cfg = Savitar_config();
+    if (cfg->recovery_objective == 0) return NULL;
+
+    size_t threads = cfg->recovery_threads;
+    if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    return new SnapshotScheduler(cfg->recovery_objective * 1000000,
+            cfg->snapshot_interval * 1000000, cfg->replay_rate << 20,
+            threads);
+}
+
+SnapshotScheduler::SnapshotScheduler(uint64_t objective_ns,
+        uint64_t interval_ns, uint64_t replay_rate, size_t threads) :
+        objective_ns(objective_ns), interval_ns(interval_ns),
+        replay_rate(replay_rate), threads(std::max(threads, (size_t)1)) {
+    assert(replay_rate > 0);
+    pthread_mutex_init(&lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // RecoveryReport::now
+    pthread_cond_init(&stop_condition, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+SnapshotScheduler::~SnapshotScheduler() {
+    assert(!running);
+    pthread_cond_destroy(&stop_condition);
+    pthread_mutex_destroy(&lock);
+}
+
+void SnapshotScheduler::start() {
+    assert(!running);
+    running = true;
+    assert(pthread_create(&thread, NULL, run, this) == 0);
+}
+
+void SnapshotScheduler::stop() {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&stop_condition);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    running = false;
+    PRINT("Snapshot scheduler: took %zu snapshot(s)\n", snapshots);
+}
+
+uint64_t SnapshotScheduler::predictReplay(uint64_t total_bytes,
+        uint64_t largest_bytes) const {
+    uint64_t bytes = std::max(total_bytes / threads, largest_bytes);
+    return (uint64_t)((double)bytes * 1E9 / replay_rate);
+}
+
+bool SnapshotScheduler::isDue(uint64_t now, uint64_t total_bytes,
+        uint64_t largest_bytes) const {
+    if (total_bytes == 0) return false;
+    if (last_snapshot != 0 && now - last_snapshot < interval_ns) return false;
+    uint64_t replay_ns = predictReplay(total_bytes, largest_bytes);
+    return replay_ns * 100 >= objective_ns * TriggerPercent;
+}
+
+void *SnapshotScheduler::run(void *arg) {
+    SnapshotScheduler *scheduler = (SnapshotScheduler *)arg;
+
+    // SIGUSR1 snapshots take the same lock as Savitar_snapshot()
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    NVManager &manager = NVManager::getInstance();
+    manager.waitForRecovery();
+    uint64_t measured = RecoveryReport::getInstance().replayRate();
+    if (measured > 0) scheduler->replay_rate = measured;
+    PRINT("Snapshot scheduler: objective = %.2f ms, replay rate = %.2f MB/s\n",
+            (double)scheduler->objective_ns / 1E6,
+            (double)scheduler->replay_rate / (1 << 20));
+
+    pthread_mutex_lock(&scheduler->lock);
+    while (!scheduler->stopping) {
+        uint64_t wakeup = RecoveryReport::now() + PollPeriod;
+        struct timespec t;
+        t.tv_sec = wakeup / 1000000000;
+        t.tv_nsec = wakeup % 1000000000;
+        pthread_cond_timedwait(&scheduler->stop_condition, &scheduler->lock, &t);
+        if (scheduler->stopping) break;
+        pthread_mutex_unlock(&scheduler->lock);
+
+        uint64_t total_bytes, largest_bytes;
+        manager.pendingLogBytes(&total_bytes, &largest_bytes);
+        uint64_t now = RecoveryReport::now();
+        if (scheduler->isDue(now, total_bytes, largest_bytes)) {
+            Savitar_snapshot();
+            scheduler->snapshotTaken(now);
+            scheduler->snapshots++;
+            PRINT("Snapshot scheduler: snapshot after %zu log bytes "
+                    "(predicted replay = %.2f ms)\n", total_bytes,
+                    (double)scheduler->predictReplay(total_bytes,
+                        largest_bytes) / 1E6);
+        }
+        pthread_mutex_lock(&scheduler->lock);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Background snapshots that bound recovery time (PRONTO_RECOVERY_OBJECTIVE)
+ * * Replay time is predicted from the log bytes appended since the last
+ *   snapshot and the replay rate of a recovery thread. Logs are replayed in
+ *   parallel, but the largest log is replayed by a single thread.
+ * * A snapshot is taken once the prediction reaches TriggerPercent of the
+ *   objective, leaving headroom for the logs that grow while it is taken.
+ * * Scheduled snapshots are at least PRONTO_SNAPSHOT_INTERVAL apart, so the
+ *   objective gives way to throughput when logs grow faster than that.
+ */
+class SnapshotScheduler {
+public:
+    // Returns NULL if there is no recovery-time objective
+    static SnapshotScheduler *create();
+    SnapshotScheduler(uint64_t objective_ns, uint64_t interval_ns,
+            uint64_t replay_rate, size_t threads);
+    ~SnapshotScheduler();
+
+    void start();
+    // Waits for a scheduled snapshot in progress (if any)
+    void stop();
+
+    // Replay time (ns) of the given log bytes
+    uint64_t predictReplay(uint64_t total_bytes, uint64_t largest_bytes) const;
+    bool isDue(uint64_t now, uint64_t total_bytes, uint64_t largest_bytes) const;
+    void snapshotTaken(uint64_t now) { last_snapshot = now; }
+
+    static const uint64_t TriggerPercent = 75;
+    static const uint64_t PollPeriod = 10000000; // 10 ms
+
+private:
+    static void *run(void *);
+
+    const uint64_t objective_ns;
+    const uint64_t interval_ns;
+    uint64_t replay_rate; // bytes/s of a recovery thread
+    const size_t threads;
+    uint64_t last_snapshot = 0; // 0 = none taken by the scheduler
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t stop_condition;
+    bool running = false;
+    bool stopping = false;
+    uint64_t snapshots = 0;
+};
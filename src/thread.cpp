@@ -1,7 +1,9 @@
 #include <unistd.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <algorithm>
 #include "thread.hpp"
 #include "persister.hpp"
 #include "nvm_manager.hpp"
@@ -10,14 +12,42 @@
 void get_cpu_info(uint8_t *core_map, int *map_size);
 
 static int available_cores = 0; // including Hyper-Threaded cores
+static bool hybrid_logging = false;
+static uint64_t hybrid_threshold = HYBRID_THRESHOLD;
+static uint64_t total_logged_entries[2] = { 0, 0 }; // { async, inline }
 static uint16_t core_tenants[MAX_CORES / 2];
 static uint8_t core_ht_map[MAX_CORES / 2][2];
+static uint8_t core_socket[MAX_CORES]; // socket of each processor id
+static PlacementPolicy placement = PlacementHTSibling;
+static QosMode qos_mode = QosOff;
+static uint64_t qos_histogram[QosClasses][QOS_HISTOGRAM_BUCKETS];
+static uint64_t qos_total_cycles[QosClasses];
+static uint64_t qos_max_cycles[QosClasses];
+volatile uint64_t pending_critical_requests = 0;
 static pthread_mutex_t core_tenants_lock;
 
+// Thread durability barriers (see Savitar_barrier)
+static volatile uint64_t barrier_waiters = 0;
+static pthread_mutex_t barrier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t barrier_durable = PTHREAD_COND_INITIALIZER;
+
 void Savitar_core_init() {
+    hybrid_logging = Savitar_config()->logging_mode == LoggingHybrid;
+    hybrid_threshold = Savitar_config()->hybrid_threshold;
+    PRINT("Hybrid logging is %s (threshold = %zu cycles)\n",
+            hybrid_logging ? "enabled" : "disabled", hybrid_threshold);
+
+    placement = Savitar_config()->placement;
+    PRINT("Persister placement policy: %s\n", Savitar_placement_name(placement));
+
+    qos_mode = Savitar_config()->qos_mode;
+
     uint8_t core_info[MAX_CORES];
     get_cpu_info(core_info, &available_cores);
     assert(available_cores <= MAX_CORES);
+    for (int i = 0; i < available_cores; i++) {
+        core_socket[i] = core_info[i] >> 5;
+    }
     PRINT("Found a total of %d active cores.\n", available_cores);
     assert(available_cores % 2 == 0);
 
@@ -46,7 +76,12 @@ void Savitar_core_init() {
     }
     PRINT("Total of %d physical cores per socket\n", cores_per_socket);
 
-#ifdef NO_HT_PINNING
+    /*
+     * Dedicated physical cores: pair each core with a core from the other
+     * half of the same socket, so that worker and persister threads never
+     * share a physical core
+     */
+    if (placement != PlacementPhysicalCore) return;
     PRINT("HT-pinning is disabled, updating the HT-map\n");
     uint8_t sockets = (available_cores / 2) / cores_per_socket;
     for (uint8_t s = 0; s < sockets; s++) {
@@ -61,7 +96,6 @@ void Savitar_core_init() {
                     core_ht_map[b + c][0], core_ht_map[b + c][1]);
         }
     }
-#endif
 }
 
 void Savitar_core_finalize() {
@@ -108,6 +142,27 @@ void Savitar_core_free(int core_id) {
         core_ht_map[physical_core_id][0], core_ht_map[physical_core_id][1]);
 }
 
+/*
+ * Pins the calling thread according to the placement policy
+ * The socket policy only pins the worker thread to its core and lets the
+ * persister thread run on any core that shares the last-level cache.
+ */
+static void Savitar_core_pin(pthread_t thread, int core_id, bool persister) {
+    if (placement == PlacementNone) return;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (placement == PlacementSocket && persister) {
+        for (int c = 0; c < available_cores; c++) {
+            if (core_socket[c] == core_socket[core_id]) CPU_SET(c, &cpuset);
+        }
+    }
+    else {
+        CPU_SET(core_id, &cpuset);
+    }
+    assert(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) == 0);
+}
+
 /*
  * tx_buffer[0] is used to index sync_buffer
  */
@@ -117,23 +172,68 @@ static __thread NvMethodCall *sync_buffer;
  * Contains offset of redo-log entries for active transactions
  * tx_buffer[0]: number of active transactions for current thread
  * tx_buffer[1+]: redo-log offset
+ * tx_buffer[TX_BUFFER_ISSUED]: number of issued outer-most transactions
+ * tx_buffer[TX_BUFFER_DURABLE]: number of committed outer-most transactions
+ * tx_buffer[TX_BUFFER_EPOCH]: snapshot epoch of the running outer-most
+ * transaction, 0 if the thread is not running a transaction
+ * tx_buffer[TX_BUFFER_BARRIERS]: barriers of other threads reading the
+ * buffer, which is only freed once they are done
  */
 static __thread uint64_t *tx_buffer;
 
+/*
+ * [Hybrid logging]
+ * notify_cycles: time-stamp of the request for each active transaction
+ * inline_logged: log entry was created by the worker (not the persister)
+ * inline_cost: moving average of cycles spent on creating log entries inline
+ * logged_entries: { async, inline } log entries for the current thread
+ */
+static __thread uint64_t notify_cycles[MAX_ACTIVE_TXS];
+static __thread bool inline_logged[MAX_ACTIVE_TXS];
+static __thread uint64_t inline_cost;
+static __thread uint64_t logged_entries[2];
+
+// Barrier epoch of the object for each active transaction
+static __thread uint64_t tx_epoch[MAX_ACTIVE_TXS];
+
+/*
+ * [QoS]
+ * Latency histogram (log2 buckets), sum and maximum of cycles between
+ * notify and commit for each class, merged when the thread terminates
+ */
+static __thread uint64_t latency_histogram[QosClasses][QOS_HISTOGRAM_BUCKETS];
+static __thread uint64_t latency_cycles[QosClasses];
+static __thread uint64_t latency_max[QosClasses];
+
+static inline uint64_t rdtscp() {
+  uint32_t aux;
+  uint64_t rax, rdx;
+  asm volatile ( "rdtscp\n" : "=a" (rax), "=d" (rdx), "=c" (aux) : : );
+  return (rdx << 32) + rax;
+}
+
+static void Savitar_tx_buffer_free(uint64_t *tx) {
+    pthread_mutex_lock(&barrier_lock);
+    while (tx[TX_BUFFER_BARRIERS] != 0) {
+        pthread_cond_wait(&barrier_durable, &barrier_lock);
+    }
+    pthread_mutex_unlock(&barrier_lock);
+    free(tx);
+}
+
 static void *routine_wrapper(void *arg) {
 
     // Prepare environment
     ThreadConfig *cfg = (ThreadConfig *)arg;
     sync_buffer = cfg->buffer;
     tx_buffer = cfg->tx_buffer;
+    inline_cost = hybrid_threshold;
 
     // Set thread core affinity
     pthread_t thread = pthread_self();
 #ifndef SYNC_SL
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(cfg->core_id, &cpuset);
-    assert(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) == 0);
+    Savitar_core_pin(thread, cfg->core_id,
+            cfg->routine == Savitar_persister_worker);
 #endif // SYNC_SL
 
     // Wait for thread routine to return
@@ -143,7 +243,7 @@ static void *routine_wrapper(void *arg) {
     if (cfg->routine == Savitar_persister_worker) {
         PRINT("[%d] Persister thread is now terminating\n", (int)thread);
         free(cfg->buffer);
-        free(cfg->tx_buffer);
+        Savitar_tx_buffer_free(cfg->tx_buffer);
 #ifndef SYNC_SL
         Savitar_core_free(cfg->core_id);
 #endif // SYNC_SL
@@ -155,10 +255,24 @@ static void *routine_wrapper(void *arg) {
         NVManager::getInstance().unregisterThread(pthread_self());
         NVManager::getInstance().unlock();
         assert(tx_buffer[0] == 0); // No active transactions
+        __sync_fetch_and_add(&total_logged_entries[0], logged_entries[0]);
+        __sync_fetch_and_add(&total_logged_entries[1], logged_entries[1]);
+        for (int c = 0; qos_mode != QosOff && c < QosClasses; c++) {
+            for (int b = 0; b < QOS_HISTOGRAM_BUCKETS; b++) {
+                __sync_fetch_and_add(&qos_histogram[c][b],
+                        latency_histogram[c][b]);
+            }
+            __sync_fetch_and_add(&qos_total_cycles[c], latency_cycles[c]);
+            uint64_t max = qos_max_cycles[c];
+            while (latency_max[c] > max && !__sync_bool_compare_and_swap(
+                        &qos_max_cycles[c], max, latency_max[c])) {
+                max = qos_max_cycles[c];
+            }
+        }
         cfg->buffer[0].method_tag = UINT64_MAX; // Signals logger thread to terminate
 #ifdef SYNC_SL
         free(cfg->buffer);
-        free(cfg->tx_buffer);
+        Savitar_tx_buffer_free(cfg->tx_buffer);
 #endif // SYNC_SL
     }
     free(cfg);
@@ -175,9 +289,9 @@ int Savitar_thread_create(pthread_t *thread, const pthread_attr_t *attr,
     memset(buffer, 0, sizeof(NvMethodCall) * MAX_ACTIVE_TXS);
 
     // Allocate transaction buffer
-    uint64_t *tx_buffer = (uint64_t *)calloc(MAX_ACTIVE_TXS + 1, sizeof(uint64_t));
+    uint64_t *tx_buffer = (uint64_t *)calloc(TX_BUFFER_SIZE, sizeof(uint64_t));
     assert(tx_buffer != NULL);
-    memset(tx_buffer, 0, sizeof(uint64_t) * (MAX_ACTIVE_TXS + 1));
+    memset(tx_buffer, 0, sizeof(uint64_t) * TX_BUFFER_SIZE);
 
 #ifndef SYNC_SL
     // Get cores which host main and logger threads
@@ -226,13 +340,6 @@ int Savitar_thread_create(pthread_t *thread, const pthread_attr_t *attr,
 
 #ifdef DEBUG
 static __thread uint64_t cycles[4];
-
-static inline uint64_t rdtscp() {
-  uint32_t aux;
-  uint64_t rax, rdx;
-  asm volatile ( "rdtscp\n" : "=a" (rax), "=d" (rdx), "=c" (aux) : : );
-  return (rdx << 32) + rax;
-}
 #endif
 
 // inline logging method for synchronous semantic logging
@@ -254,13 +361,98 @@ inline void Savitar_persister_log(uint64_t active_tx_id) {
         log_offset = nv_object->AppendLog(vector, 2);
     }
     else {
-        log_offset = nv_object->Log(sync_buffer[active_tx_id].method_tag,
+        uint64_t method_tag = sync_buffer[active_tx_id].method_tag;
+        log_offset = nv_object->Log(method_tag & ~CLAIM_TAG_MASK,
                 sync_buffer[active_tx_id].arg_ptrs);
     }
     tx_buffer[active_tx_id + 1] = log_offset;
+    asm volatile("" : : : "memory");
     sync_buffer[active_tx_id].method_tag = 0;
 }
 
+/*
+ * [Hybrid logging]
+ * Called by the worker once its persister has not picked up the request
+ * within the threshold. Creates log entries for the transaction and all of
+ * its parents that are not claimed by the persister yet. Parents must go
+ * first, as nested entries refer to the log offset of their parent.
+ */
+static void Savitar_hybrid_takeover(uint64_t active_tx_id) {
+    for (uint64_t tx = 0; tx <= active_tx_id; tx++) {
+        if (!Savitar_worker_claim(&sync_buffer[tx].method_tag)) continue;
+        uint64_t start = rdtscp();
+        Savitar_persister_log(tx);
+        inline_cost = (7 * inline_cost + rdtscp() - start) >> 3;
+        inline_logged[tx] = true;
+    }
+}
+
+void Savitar_logging_stats(uint64_t *async_entries, uint64_t *inline_entries) {
+    *async_entries = total_logged_entries[0];
+    *inline_entries = total_logged_entries[1];
+}
+
+void Savitar_qos_stats(QosClass qos_class, QosLatency *stats) {
+    assert(qos_class < QosClasses);
+    uint64_t *histogram = qos_histogram[qos_class];
+    memset(stats, 0, sizeof(QosLatency));
+    for (int b = 0; b < QOS_HISTOGRAM_BUCKETS; b++) {
+        stats->operations += histogram[b];
+    }
+    stats->total_cycles = qos_total_cycles[qos_class];
+    stats->max_cycles = qos_max_cycles[qos_class];
+
+    uint64_t seen = 0;
+    for (int b = 0; b < QOS_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram[b];
+        uint64_t upper_bound = std::min((uint64_t)2 << b, stats->max_cycles);
+        if (stats->p50_cycles == 0 && seen * 100 >= stats->operations * 50) {
+            stats->p50_cycles = upper_bound;
+        }
+        if (stats->p99_cycles == 0 && seen * 100 >= stats->operations * 99) {
+            stats->p99_cycles = upper_bound;
+        }
+    }
+}
+
+static inline void Savitar_qos_record(QosClass qos_class, uint64_t cycles) {
+    int bucket = cycles == 0 ? 0 : 63 - __builtin_clzll(cycles);
+    latency_histogram[qos_class][bucket]++;
+    latency_cycles[qos_class] += cycles;
+    if (cycles > latency_max[qos_class]) latency_max[qos_class] = cycles;
+}
+
+/*
+ * Publishes the snapshot epoch before the first operation of an outer-most
+ * transaction. The epoch is odd while a snapshot waits for running
+ * transactions (see Snapshot::blockNewTransactions), so the thread blocks
+ * until the snapshot has captured the heap. Re-reading the epoch after the
+ * fence makes sure that either the snapshot sees the published epoch or the
+ * thread sees the new one.
+ */
+static void Savitar_snapshot_enter() {
+    NVManager &manager = NVManager::getInstance();
+    volatile uint64_t *published = &tx_buffer[TX_BUFFER_EPOCH];
+    while (true) {
+        uint64_t epoch = manager.snapshotEpoch();
+        if ((epoch & 1) == 0) {
+            *published = epoch;
+            __sync_synchronize();
+            if (manager.snapshotEpoch() == epoch) return;
+            *published = 0;
+            continue;
+        }
+
+        PRINT("[%d] Worker thread is now blocked!\n", (int)pthread_self());
+        pthread_mutex_lock(manager.ckptLock());
+        while (manager.snapshotEpoch() == epoch) {
+            pthread_cond_wait(manager.ckptCondition(), manager.ckptLock());
+        }
+        pthread_mutex_unlock(manager.ckptLock());
+        PRINT("[%d] Worker thread is now unblocked!\n", (int)pthread_self());
+    }
+}
+
 void Savitar_thread_notify(int num, ...) {
 #ifdef DEBUG
     PRINT("[%d] Notifying persister with %d arguments!\n",
@@ -275,13 +467,16 @@ void Savitar_thread_notify(int num, ...) {
     uint64_t method_tag = va_arg(valist, uint64_t);
 
     PersistentObject *obj = (PersistentObject *)object_ptr;
+    if (obj->isRecovering() && !RecoveryContext::isReplaying()) {
+        // Lazy recovery: the object is not recovered yet
+        NVManager::getInstance().waitForObject(obj);
+    }
     if (obj->isRecovering()) {
         RecoveryContext& context = RecoveryContext::getInstance();
         PersistentObject *me = (PersistentObject *)object_ptr;
         PersistentObject *parent = context.popParentObject();
-        if (parent != NULL) {
-            while (!me->isWaitingForParent(parent)) { }
-        }
+        // Wait for the recovery of the child object to reach this call
+        if (parent != NULL) me->awaitParent(parent);
         context.pushParentObject(me);
         return;
     }
@@ -293,27 +488,23 @@ void Savitar_thread_notify(int num, ...) {
     }
     va_end(valist);
 
+    // Don't wait if inside a nested transaction
+    if (tx_buffer[0] == 0) Savitar_snapshot_enter();
+
     tx_buffer[0]++;
     tx_buffer[tx_buffer[0]] = 0;
 #ifndef SYNC_SL
     asm volatile("sfence" : : : "memory");
 #endif // SYNC_SL
 
-    // Don't wait if inside a nested transaction
-    if (tx_buffer[0] == 1 && obj->isWaitingForSnapshot()) {
-        PRINT("[%d] Worker thread is now blocked!\n", (int)pthread_self());
-        tx_buffer[0] = 0;
-        pthread_mutex_t *ckptLock = NVManager::getInstance().ckptLock();
-        pthread_cond_t *ckptCond = NVManager::getInstance().ckptCondition();
-        pthread_mutex_lock(ckptLock);
-        while (obj->isWaitingForSnapshot()) {
-            pthread_cond_wait(ckptCond, ckptLock);
-        }
-        pthread_mutex_unlock(ckptLock);
-        tx_buffer[0] = 1;
-        PRINT("[%d] Worker thread is now unblocked!\n", (int)pthread_self());
+    tx_epoch[tx_buffer[0] - 1] = obj->beginOperation();
+    if (tx_buffer[0] == 1) tx_buffer[TX_BUFFER_ISSUED]++;
+    if (hybrid_logging || qos_mode != QosOff) {
+        notify_cycles[tx_buffer[0] - 1] = rdtscp();
+    }
+    if (qos_mode == QosPriority && obj->getQosClass() == QosCritical) {
+        __sync_fetch_and_add(&pending_critical_requests, 1);
     }
-
     sync_buffer[tx_buffer[0] - 1].method_tag = method_tag;
 #ifdef SYNC_SL
     Savitar_persister_log(tx_buffer[0] - 1);
@@ -344,11 +535,46 @@ void Savitar_thread_wait(PersistentObject *object, SavitarLog *log) {
         RecoveryContext::getInstance().popParentObject();
         return;
     }
+    QosClass qos_class = object->getQosClass();
 #ifndef SYNC_SL
-    while (sync_buffer[tx_buffer[0] - 1].method_tag != 0) { }
+    bool dedicated = qos_mode == QosDedicated && qos_class == QosCritical;
+    if (hybrid_logging || dedicated) {
+        /*
+         * Take over from the persister if it has not picked up the request
+         * by the time creating the log entry inline would have finished.
+         * Critical objects with dedicated capacity never wait for it.
+         */
+        uint64_t active_tx_id = tx_buffer[0] - 1;
+        uint64_t threshold = dedicated ? 0 :
+            std::min(inline_cost, hybrid_threshold);
+        volatile uint64_t *tag = &sync_buffer[active_tx_id].method_tag;
+        while (*tag != 0) {
+            if ((*tag & PERSISTER_CLAIM_TAG) == 0 &&
+                    rdtscp() - notify_cycles[active_tx_id] > threshold) {
+                Savitar_hybrid_takeover(active_tx_id);
+                break;
+            }
+        }
+        logged_entries[inline_logged[active_tx_id] ? 1 : 0]++;
+        inline_logged[active_tx_id] = false;
+    }
+    else {
+        while (sync_buffer[tx_buffer[0] - 1].method_tag != 0) { }
+    }
 #endif // SYNC_SL
     assert(tx_buffer[0] > 0);
-    Savitar_log_commit(log, tx_buffer[tx_buffer[0]--]);
+    Savitar_log_commit(log, object->getControl(), tx_buffer[tx_buffer[0]--]);
+    object->endOperation(tx_epoch[tx_buffer[0]]);
+    if (tx_buffer[0] == 0) {
+        Savitar_thread_durable(tx_buffer);
+        ((volatile uint64_t *)tx_buffer)[TX_BUFFER_EPOCH] = 0;
+    }
+    if (qos_mode == QosPriority && qos_class == QosCritical) {
+        __sync_fetch_and_sub(&pending_critical_requests, 1);
+    }
+    if (qos_mode != QosOff) {
+        Savitar_qos_record(qos_class, rdtscp() - notify_cycles[tx_buffer[0]]);
+    }
 #ifdef DEBUG
     cycles[3] = rdtscp();
     fprintf(stdout, "%zu,%zu,%zu,%zu\n",
@@ -358,3 +584,55 @@ void Savitar_thread_wait(PersistentObject *object, SavitarLog *log) {
             cycles[3] - cycles[2]);
 #endif
 }
+
+void Savitar_thread_durable(uint64_t *tx) {
+    ((volatile uint64_t *)tx)[TX_BUFFER_DURABLE] = tx[TX_BUFFER_ISSUED];
+    __sync_synchronize(); // see Savitar_barrier
+    if (barrier_waiters == 0) return;
+    pthread_mutex_lock(&barrier_lock);
+    pthread_cond_broadcast(&barrier_durable);
+    pthread_mutex_unlock(&barrier_lock);
+}
+
+/*
+ * Operations of the calling thread are durable once they return, so only
+ * other threads can have pending operations. The manager lock is only held
+ * to look up the thread, its buffer is kept alive by TX_BUFFER_BARRIERS.
+ * The waiter count is raised before reading the durable counter, and the
+ * thread reads it after updating the counter, so no wake-up is lost.
+ */
+void Savitar_barrier(pthread_t thread) {
+    if (pthread_equal(thread, pthread_self())) return;
+    NVManager &manager = NVManager::getInstance();
+    manager.lock();
+    ThreadConfig *cfg = manager.findThread(thread);
+    if (cfg == NULL) {
+        manager.unlock();
+        return;
+    }
+    volatile uint64_t *tx = cfg->tx_buffer;
+    uint64_t issued = tx[TX_BUFFER_ISSUED];
+    if (tx[TX_BUFFER_DURABLE] >= issued) {
+        manager.unlock();
+        return;
+    }
+    __sync_fetch_and_add(&tx[TX_BUFFER_BARRIERS], 1);
+    manager.unlock();
+
+    __sync_fetch_and_add(&barrier_waiters, 1);
+    pthread_mutex_lock(&barrier_lock);
+    while (tx[TX_BUFFER_DURABLE] < issued) {
+        pthread_cond_wait(&barrier_durable, &barrier_lock);
+    }
+    __sync_fetch_and_sub(&barrier_waiters, 1);
+    // The buffer might be waiting to be freed (see Savitar_tx_buffer_free)
+    if (__sync_sub_and_fetch(&tx[TX_BUFFER_BARRIERS], 1) == 0) {
+        pthread_cond_broadcast(&barrier_durable);
+    }
+    pthread_mutex_unlock(&barrier_lock);
+}
+
+void Savitar_barrier(PersistentObject *object) {
+    assert(tx_buffer == NULL || tx_buffer[0] == 0);
+    object->barrier();
+}
@@ -43,3 +43,9 @@ void Savitar_thread_notify(int, ...);
  * through calling this function.
  */
 void Savitar_thread_wait(PersistentObject *, SavitarLog *log);
+
+/*
+ * Marks the outer-most transactions issued by the thread as durable and
+ * wakes up barriers waiting for them (see Savitar_barrier)
+ */
+void Savitar_thread_durable(uint64_t *tx_buffer);
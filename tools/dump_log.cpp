@@ -29,7 +29,18 @@ int main(int argc, char **argv) {
         cout << " bytes)";
     }
     cout << endl;
-    cout << "Last commit:\t" << log->last_commit << endl;
+    cout << "Watermark:\t" << log->watermark_offset;
+    cout << " (commit " << log->watermark_commit << ")" << endl;
+    // last_commit is not persisted, recover it from the entries
+    uint64_t last_commit = 0;
+    for (off_t off = sizeof(SavitarLog);
+            off < (off_t)log->tail && off < (off_t)log->size; off += 64) {
+        char *entry = (char *)log + off;
+        if (*reinterpret_cast<uint64_t *>(&entry[8]) != REDO_LOG_MAGIC) continue;
+        uint64_t commit_id = *reinterpret_cast<uint64_t *>(entry);
+        if (commit_id > last_commit) last_commit = commit_id;
+    }
+    cout << "Last commit:\t" << last_commit << endl;
     cout << "=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=";
     cout << "-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=" << endl;
     cout << "Offset\tMagic\t\t\tCommit\tTag\tParent object UUID\t\t\tOffset" << endl;
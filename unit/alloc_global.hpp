@@ -129,6 +129,7 @@ namespace {
     TEST_F(GlobalAllocTestSuite, LoadSnapshot) {
         // Initialize environment
         delete instance;
+        memset(snapshot, 0, snapshotSize);
         uintptr_t *ptrs = (uintptr_t *)snapshot;
         ptrs[0] = GlobalAlloc::MinPoolSize * 2;
         ptrs[1] = 4;
@@ -166,4 +167,35 @@ namespace {
         void *ptr = instance->alloc(FreeList::BlockSize);
         EXPECT_EQ((uintptr_t)ptr, expected);
     }
+
+    TEST_F(GlobalAllocTestSuite, BlockOwners) {
+        const size_t blockSize = FreeList::BlockSize;
+        void *owned = instance->alloc(blockSize * 2, 3);
+        void *unowned = instance->alloc(blockSize);
+        size_t block = ((uintptr_t)owned - GlobalAlloc::BaseAddress) / blockSize;
+        size_t other = ((uintptr_t)unowned - GlobalAlloc::BaseAddress) / blockSize;
+        EXPECT_EQ(instance->blockOwners()[block], 3);
+        EXPECT_EQ(instance->blockOwners()[block + 1], 3);
+        EXPECT_EQ(instance->blockOwners()[other], 0);
+
+        // Owners are part of the snapshot
+        instance->save(snapshot);
+        instance->release(owned, blockSize * 2);
+        EXPECT_EQ(instance->blockOwners()[block], 0);
+        delete instance;
+        instance = new GlobalAlloc(snapshot);
+        EXPECT_EQ(instance->blockOwners()[block], 3);
+        EXPECT_EQ(instance->blockOwners()[block + 1], 3);
+        EXPECT_EQ(instance->blockOwners()[other], 0);
+
+        // Object allocators own the blocks of their free lists
+        uuid_t uuid;
+        uuid_generate(uuid);
+        ObjectAlloc *alloc = instance->newAllocator(uuid);
+        uint16_t slot = instance->allocatorSlot(alloc);
+        EXPECT_NE(slot, 0);
+        void *ptr = alloc->alloc(64);
+        block = ((uintptr_t)ptr - GlobalAlloc::BaseAddress) / blockSize;
+        EXPECT_EQ(instance->blockOwners()[block], slot);
+    }
 }
@@ -0,0 +1,203 @@
+#include "../src/nv_log.hpp"
+#include "../src/thread.hpp"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    const useconds_t BarrierDelay = 50000; // 50 ms
+
+    TEST(BarrierTest, ObjectIdle) {
+        LogControl *control = Savitar_log_control_create();
+        Savitar_log_barrier(control);
+        uint64_t epoch = Savitar_log_begin_op(control);
+        Savitar_log_end_op(control, epoch);
+        Savitar_log_barrier(control);
+
+        // Nothing was in flight, so the epoch never flipped
+        EXPECT_EQ(control->barrier_epoch, (uint64_t)0);
+        free(control);
+    }
+
+    TEST(BarrierTest, ObjectInflight) {
+        LogControl *control = Savitar_log_control_create();
+        uint64_t epoch = Savitar_log_begin_op(control);
+
+        volatile bool done = false;
+        std::thread barrier([&]() {
+            Savitar_log_barrier(control);
+            done = true;
+        });
+        while (control->barrier_epoch == epoch) usleep(1000);
+
+        // Operations started after the barrier do not hold it back
+        uint64_t later = Savitar_log_begin_op(control);
+        EXPECT_NE(later, epoch);
+        usleep(BarrierDelay);
+        EXPECT_FALSE(done);
+        Savitar_log_end_op(control, epoch);
+        barrier.join();
+        EXPECT_TRUE(done);
+
+        Savitar_log_end_op(control, later);
+        free(control);
+    }
+
+    /*
+     * Operations that returned from begin before a barrier was called must
+     * have ended once the barrier returns, while other barriers flip the
+     * epoch concurrently
+     */
+    TEST(BarrierTest, ObjectConcurrent) {
+        const size_t Workers = 4;
+        const size_t Barriers = 4;
+        const size_t Rounds = 2000;
+        LogControl *control = Savitar_log_control_create();
+        volatile uint64_t begun[Workers];
+        volatile uint64_t ended[Workers];
+        volatile bool stop = false;
+        for (size_t w = 0; w < Workers; w++) begun[w] = ended[w] = 0;
+
+        std::vector<std::thread *> threads;
+        for (size_t w = 0; w < Workers; w++) {
+            threads.push_back(new std::thread([&, w]() {
+                while (!stop) {
+                    uint64_t epoch = Savitar_log_begin_op(control);
+                    begun[w]++;
+                    if (begun[w] % 64 == 0) sched_yield();
+                    ended[w]++;
+                    Savitar_log_end_op(control, epoch);
+                }
+            }));
+        }
+
+        volatile uint64_t violations = 0;
+        std::vector<std::thread *> barriers;
+        for (size_t b = 0; b < Barriers; b++) {
+            barriers.push_back(new std::thread([&]() {
+                for (size_t r = 0; r < Rounds; r++) {
+                    uint64_t issued[Workers];
+                    for (size_t w = 0; w < Workers; w++) issued[w] = begun[w];
+                    Savitar_log_barrier(control);
+                    for (size_t w = 0; w < Workers; w++) {
+                        if (ended[w] < issued[w]) {
+                            __sync_fetch_and_add(&violations, 1);
+                        }
+                    }
+                }
+            }));
+        }
+        for (size_t b = 0; b < Barriers; b++) {
+            barriers[b]->join();
+            delete barriers[b];
+        }
+        stop = true;
+        for (size_t w = 0; w < Workers; w++) {
+            threads[w]->join();
+            delete threads[w];
+        }
+
+        EXPECT_EQ(violations, (uint64_t)0);
+        EXPECT_EQ(control->inflight_ops[0] + control->inflight_ops[1],
+                (uint64_t)0);
+        EXPECT_EQ(control->barrier_waiters, (uint64_t)0);
+        free(control);
+    }
+
+    /*
+     * The test thread stands in for a worker thread: it is registered with
+     * the manager and updates its counters like Savitar_thread_wait/notify
+     */
+    class ThreadBarrierTest : public testing::Test {
+    protected:
+        void SetUp() override {
+            tx = (uint64_t *)calloc(TX_BUFFER_SIZE, sizeof(uint64_t));
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.tx_buffer = tx;
+            self = pthread_self();
+            NVManager &manager = NVManager::getInstance();
+            manager.lock();
+            manager.registerThread(self, &cfg);
+            manager.unlock();
+        }
+
+        void TearDown() override {
+            NVManager &manager = NVManager::getInstance();
+            manager.lock();
+            manager.unregisterThread(self);
+            manager.unlock();
+            EXPECT_EQ(tx[TX_BUFFER_BARRIERS], (uint64_t)0);
+            free(tx);
+        }
+
+        // Barriers of other threads on the test thread
+        void startBarriers(size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                barriers.push_back(new std::thread([this]() {
+                    Savitar_barrier(self);
+                    __sync_fetch_and_add(&done, 1);
+                }));
+            }
+        }
+
+        // Barriers are blocked once they hold a reference to the buffer
+        void waitForBarriers(size_t count) {
+            while (tx[TX_BUFFER_BARRIERS] < count) usleep(1000);
+            usleep(BarrierDelay);
+        }
+
+        void joinBarriers() {
+            for (size_t i = 0; i < barriers.size(); i++) {
+                barriers[i]->join();
+                delete barriers[i];
+            }
+            barriers.clear();
+        }
+
+        uint64_t *tx;
+        ThreadConfig cfg;
+        pthread_t self;
+        std::vector<std::thread *> barriers;
+        volatile uint64_t done = 0;
+    };
+
+    TEST_F(ThreadBarrierTest, Idle) {
+        // The calling thread is always durable
+        Savitar_barrier(self);
+
+        tx[TX_BUFFER_ISSUED] = tx[TX_BUFFER_DURABLE] = 3;
+        startBarriers(1);
+        joinBarriers();
+        EXPECT_EQ(done, (uint64_t)1);
+    }
+
+    TEST_F(ThreadBarrierTest, Inflight) {
+        tx[TX_BUFFER_ISSUED]++;
+        startBarriers(1);
+        waitForBarriers(1);
+        EXPECT_EQ(done, (uint64_t)0);
+
+        Savitar_thread_durable(tx);
+        joinBarriers();
+        EXPECT_EQ(done, (uint64_t)1);
+    }
+
+    TEST_F(ThreadBarrierTest, Concurrent) {
+        const size_t Barriers = 8;
+        tx[TX_BUFFER_ISSUED]++;
+        startBarriers(Barriers);
+        waitForBarriers(Barriers);
+        EXPECT_EQ(done, (uint64_t)0);
+
+        // Barriers only wait for operations issued before they were called
+        Savitar_thread_durable(tx);
+        tx[TX_BUFFER_ISSUED]++;
+        joinBarriers();
+        EXPECT_EQ(done, (uint64_t)Barriers);
+        EXPECT_LT(tx[TX_BUFFER_DURABLE], tx[TX_BUFFER_ISSUED]);
+    }
+}
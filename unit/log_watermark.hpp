@@ -0,0 +1,86 @@
+#include "restart.hpp"
+#include <map>
+
+namespace {
+
+    const uint64_t WatermarkAdds = 50; // values 1 to 50, below the watermark
+    const uint64_t WatermarkCommitted = 500;
+    const uint64_t WatermarkUncommitted = 1000;
+
+    // Counter that counts dry runs (log scans) of each value
+    class RestartScan : public RestartCounter {
+    public:
+        RestartScan() : RestartCounter() { }
+        RestartScan(uuid_t id) : RestartCounter(id) { }
+
+        static PersistentObject *RecoveryFactory(NVManager *m, CatalogEntry *e) {
+            return newRestartObject<RestartScan>(e->uuid);
+        }
+
+        static uint64_t classID() { return 4; }
+
+        // Entries up to the one at offset are checked (e.g., by a recovery)
+        void watermark(uint64_t offset) {
+            uint64_t commit_id = *((uint64_t *)((char *)log + offset));
+            Savitar_log_watermark(log, commit_id, log->tail);
+        }
+
+        // Appended but never committed, e.g., a crash before the commit
+        void addUncommitted(uint64_t value) { Log(AddTag, &value); }
+
+        size_t Play(uint64_t tag, uint64_t *args, bool dry) {
+            if (dry) dryRuns[args[0]]++;
+            return RestartCounter::Play(tag, args, dry);
+        }
+
+        static std::map<uint64_t, size_t> dryRuns;
+    };
+
+    std::map<uint64_t, size_t> RestartScan::dryRuns;
+
+    TEST(RestartPhase, DISABLED_LogWatermark) {
+        PersistentFactory::registerFactory<RestartScan>();
+
+        if (isPhase("create")) {
+            RestartScan *object = restartObject<RestartScan>(0);
+            uint64_t offset = 0;
+            for (uint64_t v = 1; v <= WatermarkAdds; v++) offset = object->add(v);
+            object->watermark(offset);
+            object->add(WatermarkCommitted);
+            object->addUncommitted(WatermarkUncommitted);
+            endPhase(true);
+        }
+
+        /*
+         * Replay dry-runs every entry once, crash fixup scans only the
+         * entries past the watermark (if any)
+         */
+        bool fixup = isPhase("fixup");
+        if (fixup || isPhase("rescan")) {
+            RestartScan *object = restartObject<RestartScan>(0);
+            for (uint64_t v = 1; v <= WatermarkAdds; v++) {
+                EXPECT_EQ(RestartScan::dryRuns[v], (size_t)1) << "value " << v;
+            }
+            size_t scans = fixup ? 2 : 1;
+            EXPECT_EQ(RestartScan::dryRuns[WatermarkCommitted], scans);
+            EXPECT_EQ(RestartScan::dryRuns[WatermarkUncommitted], scans);
+
+            // The uncommitted entry is aborted
+            EXPECT_EQ(RestartCounter::played, WatermarkAdds + 1);
+            EXPECT_EQ(object->value(),
+                    WatermarkAdds * (WatermarkAdds + 1) / 2 + WatermarkCommitted);
+            endPhase(true);
+        }
+        FAIL() << "Unknown phase";
+    }
+
+    /*
+     * Crash fixup after a watermark set by the program, then after the
+     * watermark advanced by the recovery itself (up to the log tail)
+     */
+    TEST_F(RestartTest, LogWatermark) {
+        ASSERT_TRUE(runPhase("LogWatermark", "create"));
+        ASSERT_TRUE(runPhase("LogWatermark", "fixup"));
+        ASSERT_TRUE(runPhase("LogWatermark", "rescan"));
+    }
+}
@@ -6,6 +6,20 @@
 #include "alloc_object.hpp"
 #include "alloc_free_list.hpp"
 #include "snapshot.hpp"
+#include "recovery_pool.hpp"
+#include "recovery_report.hpp"
+#include "record_ring.hpp"
+#include "partition_replay.hpp"
+#include "recovery_context.hpp"
+#include "snapshot_scheduler.hpp"
+#include "persister.hpp"
+#include "barrier.hpp"
+#include "recovery_lazy.hpp"
+#include "warm_restart.hpp"
+#include "snapshot_restore.hpp"
+#include "replay_batch.hpp"
+#include "log_watermark.hpp"
+#include "nvm_manager.hpp"
 #include "../src/savitar.hpp"
 
 namespace {
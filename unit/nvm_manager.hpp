@@ -0,0 +1,99 @@
+#include "../src/nvm_manager.hpp"
+#include "../src/nv_object.hpp"
+#include "../src/nv_log.hpp"
+#include "../src/snapshot.hpp"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <new>
+
+namespace {
+
+    // Logs one entry per update, entries are never replayed here
+    class LoggedCounter : public PersistentObject {
+    public:
+        LoggedCounter(uuid_t id) : PersistentObject(id) { }
+
+        static LoggedCounter *Factory() {
+            uuid_t id;
+            uuid_generate(id);
+            ObjectAlloc *alloc = GlobalAlloc::getInstance()->newAllocator(id);
+            void *temp = alloc->alloc(sizeof(LoggedCounter));
+            LoggedCounter *object = new (temp) LoggedCounter(id);
+            NVManager &manager = NVManager::getInstance();
+            manager.lock();
+            manager.createNew(0, object);
+            manager.unlock();
+            return object;
+        }
+
+        void add(uint64_t value) {
+            uint64_t offset = Log(0, &value);
+            Savitar_log_commit(log, control, offset);
+            counter += value;
+        }
+
+        uint64_t Log(uint64_t tag, uint64_t *args) {
+            ArgVector vector[2];
+            vector[0].addr = &tag;
+            vector[0].len = sizeof(tag);
+            vector[1].addr = args;
+            vector[1].len = sizeof(uint64_t);
+            return AppendLog(vector, 2);
+        }
+
+        size_t Play(uint64_t tag, uint64_t *args, bool dry) {
+            if (!dry) counter += args[0];
+            return sizeof(uint64_t);
+        }
+
+        uint64_t snapshotTail() const { return snapshot_tail; }
+
+    private:
+        uint64_t counter = 0;
+    };
+
+    uint32_t lastSnapshotID() {
+        Snapshot *snapshot = new Snapshot(PMEM_PATH);
+        uint32_t id = snapshot->lastSnapshotID();
+        delete snapshot;
+        return id;
+    }
+
+    /*
+     * A clean shutdown leaves nothing to replay: the next startup restores
+     * the snapshot and starts replaying from the snapshot tail (or the log
+     * head), which both point at the log tail.
+     * The object stays registered with the manager, so this runs last.
+     */
+    TEST(NVManagerTest, ShutdownCheckpoint) {
+        NVManager &manager = NVManager::getInstance();
+        LoggedCounter *object = LoggedCounter::Factory();
+        for (uint64_t i = 1; i <= 100; i++) object->add(i);
+
+        uint64_t total, largest;
+        manager.pendingLogBytes(&total, &largest);
+        EXPECT_GT(total, (uint64_t)0);
+        EXPECT_GE(total, largest);
+
+        uint32_t last = lastSnapshotID();
+        manager.shutdownCheckpoint();
+        uint32_t id = lastSnapshotID();
+        EXPECT_EQ(id, last + 1);
+
+        manager.pendingLogBytes(&total, &largest);
+        EXPECT_EQ(total, (uint64_t)0);
+        EXPECT_EQ(largest, (uint64_t)0);
+
+        SavitarLog header;
+        ASSERT_TRUE(Savitar_log_read_header(object->getUUID(), &header));
+        EXPECT_GT(header.tail, (uint64_t)sizeof(SavitarLog));
+        EXPECT_EQ(header.head, header.tail);
+        EXPECT_EQ(object->snapshotTail(), header.tail);
+        EXPECT_EQ(header.watermark_offset, header.tail);
+
+        std::string snapshotPath = PMEM_PATH;
+        snapshotPath += "/snapshot.";
+        snapshotPath += std::to_string(id);
+        remove(snapshotPath.c_str());
+    }
+}
@@ -0,0 +1,91 @@
+#include "../src/recovery_graph.hpp"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <vector>
+
+namespace {
+
+    /*
+     * Records of four partitions, where every tenth record belongs to all
+     * partitions, played by three threads
+     */
+    const size_t ReplayPartitions = 4;
+    const size_t ReplayRecords = 10000;
+
+    typedef struct ReplayState {
+        volatile uint64_t played[ReplayRecords + 1]; // by commit id
+        volatile uint64_t last[ReplayPartitions]; // commit id per partition
+        volatile uint64_t last_all; // commit id of the last record for all
+        volatile uint64_t violations;
+    } ReplayState;
+
+    void playRecord(void *context, const PartitionRecord &record) {
+        ReplayState *state = (ReplayState *)context;
+        const uint64_t id = record.commit_id;
+        __sync_fetch_and_add(&state->played[id], 1);
+
+        if (record.partition == PartitionReplay::AllPartitions) {
+            // Every prior record is played
+            for (uint64_t i = 1; i < id; i++) {
+                if (state->played[i] == 0) {
+                    __sync_fetch_and_add(&state->violations, 1);
+                }
+            }
+            state->last_all = id;
+            return;
+        }
+
+        // Commit order within the partition, after the last record for all
+        if (state->last[record.partition] > id || state->last_all > id ||
+                state->last_all < id - id % 10) {
+            __sync_fetch_and_add(&state->violations, 1);
+        }
+        state->last[record.partition] = id;
+    }
+
+    TEST(PartitionReplayTest, OrderAndBarriers) {
+        vector<PartitionRecord> records;
+        for (uint64_t id = 1; id <= ReplayRecords; id++) {
+            size_t partition = id % 10 == 0 ?
+                PartitionReplay::AllPartitions : id % ReplayPartitions;
+            PartitionRecord record = { id, 0, NULL, partition };
+            records.push_back(record);
+        }
+        // Records past the count (i.e., after a missing commit) are not played
+        PartitionRecord missing = { ReplayRecords + 2, 0, NULL, 0 };
+        records.push_back(missing);
+
+        ReplayState *state = new ReplayState();
+        memset((void *)state, 0, sizeof(ReplayState));
+        PartitionReplay replay(records, ReplayRecords, 3, playRecord, state);
+        replay.run();
+
+        for (uint64_t id = 1; id <= ReplayRecords; id++) {
+            EXPECT_EQ(state->played[id], (uint64_t)1);
+        }
+        EXPECT_EQ(state->violations, (uint64_t)0);
+        EXPECT_EQ(state->last_all, ReplayRecords);
+        delete state;
+    }
+
+    TEST(PartitionReplayTest, SingleThread) {
+        vector<PartitionRecord> records;
+        for (uint64_t id = 1; id <= 100; id++) {
+            size_t partition = id % 10 == 0 ?
+                PartitionReplay::AllPartitions : id % ReplayPartitions;
+            PartitionRecord record = { id, 0, NULL, partition };
+            records.push_back(record);
+        }
+
+        ReplayState *state = new ReplayState();
+        memset((void *)state, 0, sizeof(ReplayState));
+        PartitionReplay replay(records, records.size(), 1, playRecord, state);
+        replay.run();
+
+        for (uint64_t id = 1; id <= 100; id++) {
+            EXPECT_EQ(state->played[id], (uint64_t)1);
+        }
+        EXPECT_EQ(state->violations, (uint64_t)0);
+        delete state;
+    }
+}
@@ -0,0 +1,63 @@
+#include "../src/persister.hpp"
+#include "gtest/gtest.h"
+#include <sched.h>
+#include <stdint.h>
+#include <thread>
+
+namespace {
+
+    /*
+     * [Hybrid logging]
+     * A worker publishes requests one at a time and takes over after a few
+     * spins, racing with a persister that claims them as they appear
+     */
+    const size_t ClaimRequests = 20000;
+    const uint64_t ClaimMethodTag = 0x100;
+    volatile uint64_t claim_logged[ClaimRequests];
+
+    void claimLog(uint64_t method_tag) {
+        EXPECT_EQ(method_tag & CLAIM_TAG_MASK, (uint64_t)0);
+        claim_logged[method_tag - ClaimMethodTag]++;
+    }
+
+    TEST(PersisterTest, HybridClaim) {
+        for (size_t i = 0; i < ClaimRequests; i++) claim_logged[i] = 0;
+        volatile uint64_t tag = 0;
+        volatile bool done = false;
+        uint64_t persister_entries = 0;
+        uint64_t inline_entries = 0;
+
+        std::thread persister([&]() {
+            while (!done) {
+                uint64_t method_tag = Savitar_persister_claim(&tag);
+                if (method_tag == 0) continue;
+                claimLog(method_tag);
+                persister_entries++;
+                __sync_synchronize();
+                tag = 0;
+            }
+        });
+
+        for (size_t i = 0; i < ClaimRequests; i++) {
+            tag = ClaimMethodTag + i;
+            for (size_t spin = 0; spin < i % 64 && tag != 0; spin++) {
+                if (spin % 16 == 0) sched_yield();
+            }
+            if (Savitar_worker_claim(&tag)) {
+                EXPECT_NE(tag & WORKER_CLAIM_TAG, (uint64_t)0);
+                claimLog(tag & ~CLAIM_TAG_MASK);
+                inline_entries++;
+                __sync_synchronize();
+                tag = 0;
+            }
+            EXPECT_EQ(tag, (uint64_t)0);
+        }
+        done = true;
+        persister.join();
+
+        for (size_t i = 0; i < ClaimRequests; i++) {
+            EXPECT_EQ(claim_logged[i], (uint64_t)1);
+        }
+        EXPECT_EQ(persister_entries + inline_entries, ClaimRequests);
+    }
+}
@@ -0,0 +1,47 @@
+#include "../src/recovery_graph.hpp"
+#include "gtest/gtest.h"
+#include <pthread.h>
+#include <stdint.h>
+
+namespace {
+
+    const uint64_t RingRecords = 100000;
+
+    void *ringProducer(void *arg) {
+        RecordRing *ring = (RecordRing *)arg;
+        for (uint64_t i = 1; i <= RingRecords; i++) {
+            ScanRecord record = { (char *)(uintptr_t)i, i, i * 2 };
+            ring->push(record);
+        }
+        ring->close();
+        return NULL;
+    }
+
+    TEST(RecordRingTest, RecordsInOrder) {
+        RecordRing ring(8); // the producer blocks on a full ring often
+        pthread_t producer;
+        ASSERT_EQ(pthread_create(&producer, NULL, ringProducer, &ring), 0);
+
+        ScanRecord record;
+        uint64_t expected = 1;
+        while (ring.pop(&record)) {
+            EXPECT_EQ(record.commit_id, expected);
+            EXPECT_EQ(record.method_tag, expected * 2);
+            EXPECT_EQ(record.ptr, (char *)(uintptr_t)expected);
+            expected++;
+        }
+        EXPECT_EQ(expected, RingRecords + 1);
+        EXPECT_FALSE(ring.pop(&record));
+        pthread_join(producer, NULL);
+    }
+
+    TEST(RecordRingTest, EmptyRingAfterClose) {
+        RecordRing ring(4);
+        ScanRecord record = { NULL, 1, 0 };
+        ring.push(record);
+        ring.close();
+        EXPECT_TRUE(ring.pop(&record));
+        EXPECT_EQ(record.commit_id, 1);
+        EXPECT_FALSE(ring.pop(&record));
+    }
+}
@@ -0,0 +1,50 @@
+#include "../src/nv_object.hpp"
+#include "../src/recovery_context.hpp"
+#include "gtest/gtest.h"
+#include <pthread.h>
+#include <stdint.h>
+
+namespace {
+
+    const int ContextThreads = 8;
+    const int ContextRounds = 100000;
+
+    void *contextWorker(void *arg) {
+        RecoveryContext *context = (RecoveryContext *)arg;
+        PersistentObject *me = (PersistentObject *)pthread_self();
+        for (int i = 0; i < ContextRounds; i++) {
+            context->pushParentObject(me);
+            if (context->popParentObject() != me) return (void *)1;
+            if (context->popParentObject() != NULL) return (void *)1;
+        }
+        return NULL;
+    }
+
+    TEST(RecoveryContextTest, ParentObjectsArePerThread) {
+        RecoveryContext context;
+        pthread_t threads[ContextThreads];
+        for (int i = 0; i < ContextThreads; i++) {
+            ASSERT_EQ(pthread_create(&threads[i], NULL, contextWorker,
+                        &context), 0);
+        }
+        for (int i = 0; i < ContextThreads; i++) {
+            void *failed;
+            pthread_join(threads[i], &failed);
+            EXPECT_EQ(failed, (void *)NULL);
+        }
+        EXPECT_EQ(context.popParentObject(), (PersistentObject *)NULL);
+    }
+
+    TEST(RecoveryContextTest, LogHeadSlots) {
+        RecoveryContext context;
+        EXPECT_EQ(context.queryLogHeadOffset(RecoveryContext::NoSlot), 0);
+        EXPECT_EQ(context.queryLogHeadOffset(0), 0);
+
+        uint32_t first = context.addLogHeadOffset(4096);
+        uint32_t second = context.addLogHeadOffset(128);
+        EXPECT_NE(first, second);
+        EXPECT_EQ(context.queryLogHeadOffset(first), 4096);
+        EXPECT_EQ(context.queryLogHeadOffset(second), 128);
+        EXPECT_EQ(context.queryLogHeadOffset(RecoveryContext::NoSlot), 0);
+    }
+}
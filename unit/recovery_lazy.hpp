@@ -0,0 +1,77 @@
+#include "restart.hpp"
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    const size_t LazyObjects = 4;
+    const size_t LazyRounds = 20000;
+    const size_t LazyCreated = 8;
+
+    // Every fourth entry of all but the first object is nested
+    uint64_t lazyValue(size_t object) {
+        size_t adds = object == 0 ? LazyRounds : LazyRounds - LazyRounds / 4;
+        return adds * (object + 1);
+    }
+
+    TEST(RestartPhase, DISABLED_LazyRecovery) {
+        PersistentFactory::registerFactory<RestartCounter>();
+
+        if (isPhase("create")) {
+            std::vector<RestartCounter *> objects;
+            std::vector<uint64_t> offsets(LazyObjects);
+            for (size_t i = 0; i < LazyObjects; i++) {
+                objects.push_back(restartObject<RestartCounter>(i));
+            }
+            for (size_t r = 0; r < LazyRounds; r++) {
+                for (size_t i = 0; i < LazyObjects; i++) {
+                    if (i > 0 && r % 4 == 3) {
+                        objects[i]->addNested(objects[i - 1], offsets[i - 1]);
+                    }
+                    else offsets[i] = objects[i]->add(i + 1);
+                }
+            }
+            endPhase(true);
+        }
+
+        if (isPhase("recover")) {
+            NVManager &manager = NVManager::getInstance();
+
+            // Recovery threads look up parents while objects are created
+            while (RestartCounter::played == 0) usleep(100);
+            for (size_t i = 0; i < LazyCreated; i++) {
+                restartObject<RestartCounter>(LazyObjects + i)->add(i + 1);
+            }
+            manager.waitForRecovery();
+            for (size_t i = 0; i < LazyObjects; i++) {
+                EXPECT_EQ(restartObject<RestartCounter>(i)->value(),
+                        lazyValue(i));
+            }
+            endPhase(false);
+        }
+
+        if (isPhase("restart")) {
+            for (size_t i = 0; i < LazyObjects; i++) {
+                EXPECT_EQ(restartObject<RestartCounter>(i)->value(),
+                        lazyValue(i));
+            }
+            for (size_t i = 0; i < LazyCreated; i++) {
+                EXPECT_EQ(restartObject<RestartCounter>(LazyObjects + i)->value(),
+                        i + 1);
+            }
+            endPhase(false);
+        }
+        FAIL() << "Unknown phase";
+    }
+
+    /*
+     * Objects created by the program while lazy recovery is replaying nested
+     * transactions, then recovered along with the others after a restart
+     */
+    TEST_F(RestartTest, LazyRecovery) {
+        ASSERT_TRUE(runPhase("LazyRecovery", "create"));
+        ASSERT_TRUE(runPhase("LazyRecovery", "recover",
+                    { "PRONTO_RECOVERY=lazy", "PRONTO_RECOVERY_THREADS=2" }));
+        ASSERT_TRUE(runPhase("LazyRecovery", "restart"));
+    }
+}
@@ -0,0 +1,194 @@
+#include "../src/recovery_pool.hpp"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <sched.h>
+#include <vector>
+
+namespace {
+
+    /*
+     * Objects are only used as opaque pointers by the pool, so the tests
+     * index a table of fake objects using the pointer value
+     */
+    const size_t FakeObjects = 64;
+    volatile uint64_t steps[FakeObjects];
+    volatile uint64_t finished[FakeObjects];
+    volatile uint64_t finish_order[FakeObjects];
+    volatile uint64_t finish_counter;
+    volatile uint64_t parked[FakeObjects];
+
+    PersistentObject *fakeObject(size_t id) {
+        return (PersistentObject *)(uintptr_t)(id + 1);
+    }
+
+    size_t fakeId(PersistentObject *object) {
+        return (size_t)(uintptr_t)object - 1;
+    }
+
+    void resetFakeObjects() {
+        for (size_t i = 0; i < FakeObjects; i++) {
+            steps[i] = finished[i] = finish_order[i] = parked[i] = 0;
+        }
+        finish_counter = 0;
+    }
+
+    // Finishes in a single step
+    bool simpleStep(PersistentObject *object) {
+        size_t id = fakeId(object);
+        steps[id]++;
+        finish_order[id] = __sync_fetch_and_add(&finish_counter, 1);
+        finished[id] = 1;
+        return true;
+    }
+
+    /*
+     * Odd objects wait (suspend) until their even neighbor is finished,
+     * which then resumes them
+     */
+    RecoveryPool *suspending_pool = NULL;
+    pthread_mutex_t parked_lock = PTHREAD_MUTEX_INITIALIZER;
+    bool suspendingStep(PersistentObject *object) {
+        size_t id = fakeId(object);
+        __sync_fetch_and_add(&steps[id], 1);
+        pthread_mutex_lock(&parked_lock);
+        if (id % 2 == 1 && finished[id - 1] == 0) {
+            parked[id] = 1;
+            pthread_mutex_unlock(&parked_lock);
+            return false;
+        }
+        finished[id] = 1;
+        bool resume = id % 2 == 0 && parked[id + 1] == 1;
+        parked[id + 1] = 0;
+        pthread_mutex_unlock(&parked_lock);
+        if (resume) suspending_pool->resume(fakeObject(id + 1));
+        return true;
+    }
+
+    /*
+     * Even objects block (without suspending) until their odd neighbor has
+     * started, as a parent replaying a nested call does
+     */
+    RecoveryPool *blocking_pool = NULL;
+    bool blockingStep(PersistentObject *object) {
+        size_t id = fakeId(object);
+        steps[id]++;
+        if (id % 2 == 0 && steps[id + 1] == 0) {
+            blocking_pool->beginBlocking();
+            while (steps[id + 1] == 0) sched_yield();
+            blocking_pool->endBlocking();
+        }
+        finished[id] = 1;
+        return true;
+    }
+
+    // The first object waits until the test releases it
+    volatile uint64_t released = 0;
+    bool gatedStep(PersistentObject *object) {
+        size_t id = fakeId(object);
+        steps[id]++;
+        while (id == 0 && released == 0) sched_yield();
+        finish_order[id] = __sync_fetch_and_add(&finish_counter, 1);
+        finished[id] = 1;
+        return true;
+    }
+
+    TEST(RecoveryPoolTest, RecoversAllObjects) {
+        resetFakeObjects();
+        RecoveryPool pool(4, simpleStep);
+        for (size_t i = 0; i < FakeObjects; i++) {
+            pool.add(fakeObject(i), i * 4096);
+        }
+        pool.run();
+        for (size_t i = 0; i < FakeObjects; i++) {
+            EXPECT_EQ(steps[i], 1);
+            EXPECT_EQ(finished[i], 1);
+        }
+    }
+
+    TEST(RecoveryPoolTest, LargestLogsFirst) {
+        resetFakeObjects();
+        RecoveryPool pool(1, simpleStep);
+        for (size_t i = 0; i < 8; i++) {
+            pool.add(fakeObject(i), (i % 3) * 1024 + i);
+        }
+        pool.run();
+        for (size_t i = 0; i < 8; i++) {
+            for (size_t j = 0; j < 8; j++) {
+                uint64_t size_i = (i % 3) * 1024 + i;
+                uint64_t size_j = (j % 3) * 1024 + j;
+                if (size_i > size_j) EXPECT_LT(finish_order[i], finish_order[j]);
+            }
+        }
+    }
+
+    TEST(RecoveryPoolTest, SuspendedObjectsAreResumed) {
+        resetFakeObjects();
+        RecoveryPool pool(2, suspendingStep);
+        suspending_pool = &pool;
+        // Odd objects are larger, so they are scheduled before their neighbor
+        for (size_t i = 0; i < 16; i++) {
+            pool.add(fakeObject(i), (i % 2 == 1) ? 8192 : 4096);
+        }
+        pool.run();
+        suspending_pool = NULL;
+        for (size_t i = 0; i < 16; i++) {
+            EXPECT_EQ(finished[i], 1);
+            EXPECT_EQ(parked[i], 0);
+            if (i % 2 == 1) EXPECT_LE(steps[i], 2);
+            else EXPECT_EQ(steps[i], 1);
+        }
+    }
+
+    TEST(RecoveryPoolTest, BlockedWorkersAreCompensated) {
+        resetFakeObjects();
+        RecoveryPool pool(1, blockingStep);
+        blocking_pool = &pool;
+        // Even objects are larger, so the only worker blocks on them first
+        for (size_t i = 0; i < 8; i++) {
+            pool.add(fakeObject(i), (i % 2 == 0) ? 8192 : 4096);
+        }
+        pool.run();
+        blocking_pool = NULL;
+        for (size_t i = 0; i < 8; i++) {
+            EXPECT_EQ(finished[i], 1);
+        }
+    }
+
+    TEST(RecoveryPoolTest, PrioritizedObjectsGoFirst) {
+        resetFakeObjects();
+        released = 0;
+        RecoveryPool pool(1, gatedStep);
+        for (size_t i = 0; i < 8; i++) {
+            pool.add(fakeObject(i), (8 - i) * 1024);
+        }
+        pool.start();
+        while (steps[0] == 0) sched_yield();
+        pool.prioritize(fakeObject(7));
+        released = 1;
+        pool.wait();
+        EXPECT_EQ(finish_order[0], 0);
+        EXPECT_EQ(finish_order[7], 1);
+        for (size_t i = 1; i < 7; i++) {
+            EXPECT_EQ(finish_order[i], i + 1);
+        }
+    }
+
+    TEST(RecoveryPoolTest, LendsIdleThreads) {
+        resetFakeObjects();
+        released = 0;
+        RecoveryPool pool(4, gatedStep);
+        pool.add(fakeObject(0), 4096);
+        pool.start();
+        while (steps[0] == 0) sched_yield();
+
+        // One thread recovers the only object, the others are idle
+        EXPECT_EQ(pool.borrowThreads(8), (size_t)3);
+        EXPECT_EQ(pool.borrowThreads(1), (size_t)0);
+        pool.returnThreads(2);
+        EXPECT_EQ(pool.borrowThreads(1), (size_t)1);
+        pool.returnThreads(2);
+        released = 1;
+        pool.wait();
+        EXPECT_EQ(finished[0], 1);
+    }
+}
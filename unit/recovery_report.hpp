@@ -0,0 +1,52 @@
+#include "../src/recovery_report.hpp"
+#include "gtest/gtest.h"
+#include <stdio.h>
+#include <string>
+
+namespace {
+
+    std::string reportToString(RecoveryReport &report) {
+        FILE *file = tmpfile();
+        report.write(file);
+        std::string output;
+        rewind(file);
+        int c;
+        while ((c = fgetc(file)) != EOF) output.push_back((char)c);
+        fclose(file);
+        return output;
+    }
+
+    TEST(RecoveryReportTest, SingleLineJSON) {
+        RecoveryReport &report = RecoveryReport::getInstance();
+        report.addPhase(PhaseLogFixup, 1000);
+        report.addPhase(PhaseLogFixup, 500);
+        report.setPageRestore((size_t)4 << 20, true, 1, 0, 1);
+        report.setPrologue(700, 3);
+        ObjectRecoveryReport object = { "object-uuid", 4096, 10, 2000, 300 };
+        report.addObject(object);
+
+        std::string output = reportToString(report);
+        EXPECT_EQ(output.find('\n'), output.size() - 1);
+        EXPECT_EQ(output.front(), '{');
+        EXPECT_NE(output.find("\"log_fixup\":1500"), std::string::npos);
+        EXPECT_NE(output.find("\"prologue_ns\":700,\"deferred_logs\":3"),
+                std::string::npos);
+        EXPECT_NE(output.find("\"mode\":\"lazy\",\"bytes\":4194304"),
+                std::string::npos);
+        EXPECT_NE(output.find("{\"uuid\":\"object-uuid\",\"log_bytes\":4096,"
+                    "\"entries\":10,\"replay_ns\":2000,"
+                    "\"replay_ns_per_entry\":200,\"blocked_ns\":300}"),
+                std::string::npos);
+    }
+
+    TEST(RecoveryReportTest, CompleteOnceAllPartsEnd) {
+        RecoveryReport &report = RecoveryReport::getInstance();
+        EXPECT_TRUE(report.isComplete());
+        report.beginPart(); // replay
+        report.beginPart(); // lazy page restore
+        report.endPart();
+        EXPECT_FALSE(report.isComplete());
+        report.endPart();
+        EXPECT_TRUE(report.isComplete());
+    }
+}
@@ -0,0 +1,90 @@
+#include "restart.hpp"
+#include <utility>
+#include <vector>
+
+namespace {
+
+    const size_t BatchSize = 4;
+    const size_t BatchAddsBefore = 10; // entries before the nested entry
+    const size_t BatchAddsAfter = 5;
+
+    // Counter that replays runs of entries with PlayBatch()
+    class RestartBatch : public RestartCounter {
+    public:
+        RestartBatch() : RestartCounter() { }
+        RestartBatch(uuid_t id) : RestartCounter(id) { }
+
+        static PersistentObject *RecoveryFactory(NVManager *m, CatalogEntry *e) {
+            return newRestartObject<RestartBatch>(e->uuid);
+        }
+
+        static uint64_t classID() { return 3; }
+
+        uint64_t lastPlayed() const { return last_played_commit_id; }
+
+        // Batches played: size and the last commit played before
+        static std::vector<std::pair<size_t, uint64_t>> batches;
+
+    protected:
+        size_t ReplayBatchSize() { return BatchSize; }
+
+        void PlayBatch(const ReplayEntry *entries, size_t n) {
+            batches.push_back(std::make_pair(n, last_played_commit_id));
+            for (size_t i = 0; i < n; i++) {
+                assert(entries[i].tag == AddTag);
+                counter += entries[i].args[0];
+            }
+        }
+    };
+
+    std::vector<std::pair<size_t, uint64_t>> RestartBatch::batches;
+
+    TEST(RestartPhase, DISABLED_ReplayBatch) {
+        PersistentFactory::registerFactory<RestartCounter>();
+        PersistentFactory::registerFactory<RestartBatch>();
+
+        if (isPhase("create")) {
+            RestartCounter *parent = restartObject<RestartCounter>(0);
+            RestartBatch *object = restartObject<RestartBatch>(1);
+            for (size_t i = 1; i <= BatchAddsBefore; i++) object->add(i);
+            object->addNested(parent, parent->add(100));
+            for (size_t i = 1; i <= BatchAddsAfter; i++) object->add(i);
+            parent->add(200);
+            endPhase(true);
+        }
+
+        // Replayed after each crash (no snapshot), either pipelined or not
+        if (isPhase("recover")) {
+            RestartCounter *parent = restartObject<RestartCounter>(0);
+            RestartBatch *object = restartObject<RestartBatch>(1);
+
+            // The default path plays each entry
+            EXPECT_EQ(RestartCounter::played, (uint64_t)2);
+            EXPECT_EQ(parent->value(), (uint64_t)300);
+
+            // Flushed before the nested entry and at the end of the log
+            const size_t n = BatchAddsBefore;
+            std::vector<std::pair<size_t, uint64_t>> expected = {
+                { 4, 0 }, { 4, 4 }, { n - 8, 8 }, { 4, n + 1 }, { 1, n + 5 } };
+            EXPECT_EQ(RestartBatch::batches, expected);
+            EXPECT_EQ(object->lastPlayed(), BatchAddsBefore + 1 + BatchAddsAfter);
+            uint64_t sum = BatchAddsBefore * (BatchAddsBefore + 1) / 2 +
+                BatchAddsAfter * (BatchAddsAfter + 1) / 2;
+            EXPECT_EQ(object->value(), sum);
+            endPhase(true);
+        }
+        FAIL() << "Unknown phase";
+    }
+
+    /*
+     * Batched replay of an object with a nested entry in the middle of its
+     * log, next to an object replayed entry by entry
+     */
+    TEST_F(RestartTest, ReplayBatch) {
+        ASSERT_TRUE(runPhase("ReplayBatch", "create"));
+        ASSERT_TRUE(runPhase("ReplayBatch", "recover",
+                    { "PRONTO_RECOVERY_PIPELINE=0" }));
+        ASSERT_TRUE(runPhase("ReplayBatch", "recover",
+                    { "PRONTO_RECOVERY_PIPELINE=1" }));
+    }
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include "../src/savitar.hpp"
+#include "gtest/gtest.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <experimental/filesystem>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+    namespace fs = std::experimental::filesystem;
+
+    /*
+     * Restart tests
+     * The runtime is a process-wide singleton at a fixed address, so startup
+     * is tested in new processes: each phase of a scenario (e.g., before and
+     * after a crash) runs RestartPhase.DISABLED_<scenario> of this binary in
+     * a child process, which reads the phase from UNIT_RESTART_PHASE.
+     * The files of this process are moved aside meanwhile, so that scenarios
+     * start from an empty PMEM_PATH and leave nothing behind.
+     */
+    const char *const RestartStash = PMEM_PATH ".unit";
+    const int PhaseExit = 42; // phases that ran to completion
+
+    class RestartTest : public testing::Test {
+    protected:
+        void SetUp() override {
+            fs::create_directory(RestartStash);
+            moveFiles(PMEM_PATH, RestartStash);
+        }
+
+        void TearDown() override {
+            for (auto &p : fs::directory_iterator(PMEM_PATH)) {
+                if (p.path() != RestartStash) fs::remove_all(p.path());
+            }
+            moveFiles(RestartStash, PMEM_PATH);
+            fs::remove(RestartStash);
+        }
+
+        // Runs a phase in a new process, env holds NAME=value pairs
+        bool runPhase(const char *scenario, const char *phase,
+                const std::vector<std::string> &env = {}) {
+            std::string filter = "--gtest_filter=RestartPhase.DISABLED_";
+            filter += scenario;
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                setenv("UNIT_RESTART_PHASE", phase, 1);
+                for (size_t i = 0; i < env.size(); i++) {
+                    putenv(strdup(env[i].c_str()));
+                }
+                execl("/proc/self/exe", "test", filter.c_str(),
+                        "--gtest_also_run_disabled_tests", (char *)NULL);
+                _exit(1);
+            }
+            int status;
+            if (pid < 0 || waitpid(pid, &status, 0) != pid) return false;
+            return WIFEXITED(status) && WEXITSTATUS(status) == PhaseExit;
+        }
+
+    private:
+        void moveFiles(const fs::path &from, const fs::path &to) {
+            for (auto &p : fs::directory_iterator(from)) {
+                if (p.path() == RestartStash) continue;
+                fs::rename(p.path(), to / p.path().filename());
+            }
+        }
+    };
+
+    // Phase of the scenario run by this process (see runPhase)
+    bool isPhase(const char *phase) {
+        const char *current = getenv("UNIT_RESTART_PHASE");
+        return current != NULL && strcmp(current, phase) == 0;
+    }
+
+    /*
+     * Ends a phase, either like a crash (no destructors, the catalog is not
+     * marked as cleanly shut down) or like a program returning from main
+     */
+    void endPhase(bool crash) {
+        int status = testing::Test::HasFailure() ? 1 : PhaseExit;
+        fflush(stdout);
+        if (crash) _exit(status);
+        exit(status);
+    }
+
+    void restartUUID(uint64_t index, uuid_t id) {
+        char uuid_str[37];
+        snprintf(uuid_str, sizeof(uuid_str), "5e5e5e5e-0000-4000-8000-%012zx",
+                (size_t)index);
+        ASSERT_EQ(uuid_parse(uuid_str, id), 0);
+    }
+
+    // Factory methods, as generated for persistent types
+    template <class T>
+    T *newRestartObject(uuid_t id) {
+        ObjectAlloc *alloc = GlobalAlloc::getInstance()->newAllocator(id);
+        void *temp = alloc->alloc(sizeof(T));
+        return new (temp) T(id);
+    }
+
+    template <class T>
+    T *restartObject(uint64_t index) {
+        uuid_t id;
+        restartUUID(index, id);
+        NVManager &manager = NVManager::getInstance();
+        manager.lock();
+        T *obj = (T *)manager.findRecovered(id);
+        if (obj == NULL) {
+            obj = newRestartObject<T>(id);
+            manager.createNew(T::classID(), obj);
+        }
+        manager.unlock();
+        manager.waitForObject(obj); // lazy recovery
+        return obj;
+    }
+
+    /*
+     * Counter with one log entry per update, or per dependency on an entry
+     * of a parent object (nested transaction)
+     */
+    class RestartCounter : public PersistentObject {
+    public:
+        RestartCounter() : PersistentObject(true) { }
+        RestartCounter(uuid_t id) : PersistentObject(id) { }
+
+        static PersistentObject *RecoveryFactory(NVManager *m, CatalogEntry *e) {
+            return newRestartObject<RestartCounter>(e->uuid);
+        }
+
+        static uint64_t classID() { return 1; }
+
+        // Returns the offset of the log entry
+        uint64_t add(uint64_t value) {
+            uint64_t offset = Log(AddTag, &value);
+            Savitar_log_commit(log, control, offset);
+            counter += value;
+            return offset;
+        }
+
+        void addNested(RestartCounter *parent, uint64_t parent_offset) {
+            uint64_t nested_tx_tag = parent_offset | NESTED_TX_TAG;
+            ArgVector vector[2];
+            vector[0].addr = &nested_tx_tag;
+            vector[0].len = sizeof(nested_tx_tag);
+            vector[1].addr = parent->getUUID();
+            vector[1].len = sizeof(uuid_t);
+            Savitar_log_commit(log, control, AppendLog(vector, 2));
+        }
+
+        uint64_t value() const { return counter; }
+
+        uint64_t Log(uint64_t tag, uint64_t *args) {
+            ArgVector vector[2];
+            vector[0].addr = &tag;
+            vector[0].len = sizeof(tag);
+            vector[1].addr = args;
+            vector[1].len = sizeof(uint64_t);
+            return AppendLog(vector, 2);
+        }
+
+        size_t Play(uint64_t tag, uint64_t *args, bool dry) {
+            assert(tag == AddTag);
+            if (!dry) {
+                counter += args[0];
+                __sync_fetch_and_add(&played, 1);
+            }
+            return sizeof(uint64_t);
+        }
+
+        static volatile uint64_t played; // entries played by this process
+
+    protected:
+        enum MethodTags {
+            AddTag = 1,
+        };
+
+        uint64_t counter = 0;
+    };
+
+    volatile uint64_t RestartCounter::played = 0;
+}
@@ -1,12 +1,25 @@
 #include "../src/snapshot.hpp"
 #include "../src/savitar.hpp"
+#include "../src/thread.hpp"
 #include "gtest/gtest.h"
 #include <limits.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <thread>
+#include <algorithm>
 
 namespace {
 
+    // Same as the handler of Savitar_main (see context.cpp)
+    void snapshotFaultHandler(int sig, siginfo_t *si, void *unused) {
+        if (Snapshot::anyActiveSnapshot()) {
+            Snapshot::getInstance()->pageFaultHandler(si->si_addr);
+        }
+        else if (!Snapshot::trackWrite(si->si_addr)) abort();
+    }
+
     class SnapshotTestSuite : public testing::Test {
         protected:
             virtual void SetUp() {  }
@@ -31,6 +44,46 @@ namespace {
             void extendSnapshot(Snapshot *o, size_t blocks) {
                 o->extendSnapshot(blocks);
             }
+            size_t workerCount(Snapshot *o, size_t blocks, bool saving) {
+                return o->workerCount(blocks, saving);
+            }
+            void blockNewTransactions(Snapshot *o) { o->blockNewTransactions(); }
+            void unblockNewTransactions(Snapshot *o) {
+                o->unblockNewTransactions();
+            }
+            void waitForRunningTransactions(Snapshot *o) {
+                o->waitForRunningTransactions();
+            }
+            void loadSnapshot(Snapshot *o, uint32_t id) { o->loadSnapshot(id); }
+            void restorePages(Snapshot *o, size_t blocks) {
+                o->restorePages(blocks);
+            }
+            // Leaves the heap writable (incremental snapshots)
+            void stopTracking() {
+                assert(mprotect((void *)GlobalAlloc::BaseAddress,
+                            Snapshot::trackedBlocks * FreeList::BlockSize,
+                            PROT_READ | PROT_WRITE) == 0);
+                free((void *)Snapshot::dirtyBlocks);
+                Snapshot::dirtyBlocks = NULL;
+                Snapshot::trackedBlocks = 0;
+                Snapshot::trackedSnapshot = 0;
+                Snapshot::chainLength = 0;
+            }
+            void recordSyncLatency(uint64_t us) { Snapshot::recordSyncLatency(us); }
+            void writeHeader(uint32_t id, uint32_t base, uint64_t time) {
+                snapshot_header_t header;
+                memset(&header, 0, sizeof(header));
+                header.identifier = id;
+                header.base_identifier = base;
+                header.time = time;
+                std::string snapshotPath = PMEM_PATH;
+                snapshotPath += "/snapshot.";
+                snapshotPath += std::to_string(id);
+                FILE *file = fopen(snapshotPath.c_str(), "w");
+                ASSERT_TRUE(file != NULL);
+                fwrite(&header, sizeof(header), 1, file);
+                fclose(file);
+            }
     };
 
     TEST_F(SnapshotTestSuite, Singleton) {
@@ -57,6 +110,8 @@ namespace {
         snapshotSize += GlobalAlloc::snapshotSize();
         snapshotSize += GlobalAlloc::getInstance()->bitmapSize();
         if (snapshotSize % 64 != 0) snapshotSize += 64 - (snapshotSize % 64);
+        size_t deltaOffset = snapshotSize;
+        snapshotSize += Snapshot::deltaMapSize();
         snapshot_header_t *header = getView(ckpt);
         EXPECT_EQ(header->identifier, 1);
         EXPECT_EQ(header->time, 0);
@@ -68,6 +123,9 @@ namespace {
         EXPECT_EQ(header->data_offset, snapshotSize);
         EXPECT_EQ(header->alloc_offset, header->global_offset +
                 GlobalAlloc::getInstance()->snapshotSize());
+        EXPECT_EQ(header->delta_offset, deltaOffset);
+        EXPECT_EQ(header->base_identifier, header->identifier); // full
+        EXPECT_EQ(header->saved_blocks, 0);
 
         cleanEnvironment(ckpt);
         EXPECT_EQ(getView(ckpt), nullptr);
@@ -146,7 +204,14 @@ namespace {
         size_t blocks = 1 + rand() % 10;
         extendSnapshot(ckpt, blocks);
         size_t newSize = getView(ckpt)->size;
-        EXPECT_EQ(newSize, oldSize + blocks * FreeList::BlockSize);
+        size_t dataOffset = getView(ckpt)->data_offset;
+        EXPECT_EQ(newSize, dataOffset + blocks * FreeList::BlockSize);
+
+        // Page map (64 bytes per block) and page-aligned data
+        EXPECT_TRUE(getView(ckpt)->flags & SnapshotPageHoles);
+        EXPECT_EQ(getView(ckpt)->page_offset, oldSize);
+        EXPECT_GE(dataOffset, oldSize + blocks * 64);
+        EXPECT_EQ(dataOffset % GlobalAlloc::BitmapGranularity, 0);
         delete ckpt;
         removeSnapshot();
     }
@@ -176,9 +241,9 @@ namespace {
         context[0] = Snapshot::getInstance()->UsedHugePage;
 
         // Extend snapshot by one block
-        size_t oldSize = getView(ckpt)->size;
         extendSnapshot(ckpt, 1);
-        EXPECT_EQ(getView(ckpt)->size, oldSize + FreeList::BlockSize);
+        EXPECT_EQ(getView(ckpt)->size,
+                getView(ckpt)->data_offset + FreeList::BlockSize);
         char *dataPtr = (char *)getView(ckpt) + getView(ckpt)->data_offset;
         memset(dataPtr, 0, FreeList::BlockSize);
 
@@ -217,10 +282,200 @@ namespace {
         }
         EXPECT_EQ(context[0], Snapshot::getInstance()->SavedHugePage);
 
+        // Pages (or free region headers) filled with zeros are holes
+        uint64_t *pages = (uint64_t *)((char *)getView(ckpt) +
+                getView(ckpt)->page_offset);
+        for (size_t i = 0; i < PPBlk; i++) {
+            bool saved = (pages[i / 64] >> (i % 64)) & 1;
+            EXPECT_EQ(saved, i % 255 != 0);
+        }
+
         removeSnapshot();
         delete ckpt;
     }
 
+    TEST_F(SnapshotTestSuite, TrackWrite) {
+        // Nothing is tracked before the first incremental snapshot
+        EXPECT_FALSE(Snapshot::trackWrite((void *)GlobalAlloc::BaseAddress));
+        EXPECT_FALSE(Snapshot::trackWrite(NULL));
+    }
+
+    TEST_F(SnapshotTestSuite, WorkerCount) {
+        Snapshot *ckpt = new Snapshot(PMEM_PATH);
+        const size_t cores = sysconf(_SC_NPROCESSORS_ONLN);
+        const size_t writers = Savitar_config()->snapshot_writers;
+
+        // At least one worker, at most one per chunk of blocks
+        EXPECT_EQ(workerCount(ckpt, 0, false), 1);
+        EXPECT_EQ(workerCount(ckpt, 1, true), 1);
+        EXPECT_EQ(workerCount(ckpt, Snapshot::ChunkBlocks + 1, false),
+                std::min(cores, (size_t)2));
+
+        // Bounded by cores, and by NVM writers when saving
+        size_t blocks = Snapshot::ChunkBlocks * 4096 + 3;
+        EXPECT_EQ(workerCount(ckpt, blocks, false), cores);
+        EXPECT_LE(workerCount(ckpt, blocks, true), cores);
+        if (writers > 0) {
+            EXPECT_LE(workerCount(ckpt, blocks, true), writers);
+        }
+        delete ckpt;
+    }
+
+    TEST_F(SnapshotTestSuite, EpochQuiescence) {
+        Snapshot *ckpt = new Snapshot(PMEM_PATH);
+        NVManager &manager = NVManager::getInstance();
+        uint64_t tx_buffer[TX_BUFFER_SIZE] = { 0 };
+        ThreadConfig cfg;
+        cfg.tx_buffer = tx_buffer;
+        pthread_t self = pthread_self();
+        manager.registerThread(self, &cfg);
+
+        // Running transaction of the current epoch
+        uint64_t epoch = manager.snapshotEpoch();
+        EXPECT_EQ(epoch % 2, 0);
+        tx_buffer[TX_BUFFER_EPOCH] = epoch;
+        blockNewTransactions(ckpt);
+        EXPECT_EQ(manager.snapshotEpoch(), epoch + 1);
+
+        std::thread commit([&tx_buffer]() {
+                usleep(10000);
+                ((volatile uint64_t *)tx_buffer)[TX_BUFFER_EPOCH] = 0; });
+        waitForRunningTransactions(ckpt);
+        EXPECT_EQ(tx_buffer[TX_BUFFER_EPOCH], 0);
+        commit.join();
+
+        unblockNewTransactions(ckpt);
+        EXPECT_EQ(manager.snapshotEpoch(), epoch + 2);
+        manager.unregisterThread(self);
+        delete ckpt;
+    }
+
+    TEST_F(SnapshotTestSuite, SyncLatencyHistogram) {
+        SnapshotLatency before;
+        Savitar_snapshot_stats(&before);
+        EXPECT_EQ(before.snapshots, 0);
+
+        for (int i = 0; i < 10; i++) recordSyncLatency(100);
+        recordSyncLatency(5000);
+
+        SnapshotLatency stats;
+        Savitar_snapshot_stats(&stats);
+        EXPECT_EQ(stats.snapshots, 11);
+        EXPECT_EQ(stats.total_us, 6000);
+        EXPECT_EQ(stats.max_us, 5000);
+        EXPECT_EQ(stats.p50_us, 128); // [64, 128)
+        EXPECT_EQ(stats.p99_us, 5000); // bounded by the maximum
+    }
+
+    TEST_F(SnapshotTestSuite, Retention) {
+        Snapshot *ckpt = new Snapshot(PMEM_PATH);
+        SavitarConfig *cfg = Savitar_config();
+        const time_t now = time(NULL);
+        for (uint64_t i = 1; i <= 5; i++) removeSnapshot(i);
+        writeHeader(1, 1, now - 1000);
+        writeHeader(2, 2, 0); // interrupted
+        writeHeader(3, 3, now - 100);
+        writeHeader(4, 3, now - 10); // incremental
+        writeHeader(5, 5, 0); // in progress
+        EXPECT_EQ(ckpt->lastCompleteSnapshotID(), 4);
+
+        // Disabled by default
+        vector<uint32_t> expired;
+        ckpt->expiredSnapshots(now, expired);
+        EXPECT_TRUE(expired.empty());
+
+        // The base of the latest snapshot is kept
+        cfg->snapshot_retain = 1;
+        ckpt->expiredSnapshots(now, expired);
+        std::sort(expired.begin(), expired.end());
+        EXPECT_EQ(expired, vector<uint32_t>({ 1, 2 }));
+
+        cfg->snapshot_retain = 3;
+        expired.clear();
+        ckpt->expiredSnapshots(now, expired);
+        EXPECT_EQ(expired, vector<uint32_t>({ 2 }));
+
+        cfg->snapshot_retain = 0;
+        cfg->snapshot_retain_time = 500;
+        expired.clear();
+        ckpt->expiredSnapshots(now, expired);
+        std::sort(expired.begin(), expired.end());
+        EXPECT_EQ(expired, vector<uint32_t>({ 1, 2 }));
+
+        ckpt->collectExpired();
+        Snapshot::waitForCollector();
+        EXPECT_EQ(access(PMEM_PATH "/snapshot.1", F_OK), -1);
+        EXPECT_EQ(access(PMEM_PATH "/snapshot.3", F_OK), 0);
+        EXPECT_EQ(access(PMEM_PATH "/snapshot.5", F_OK), 0);
+
+        cfg->snapshot_retain_time = 0;
+        for (uint64_t i = 1; i <= 5; i++) removeSnapshot(i);
+        delete ckpt;
+    }
+
+    /*
+     * A full snapshot, then an incremental one that only saves the block
+     * written in between: restoring the incremental snapshot copies each
+     * block from the newest snapshot of the chain that saved it
+     */
+    TEST_F(SnapshotTestSuite, IncrementalRestore) {
+        SavitarConfig *cfg = Savitar_config();
+        const uint64_t incrementalSnapshots = cfg->incremental_snapshots;
+        cfg->incremental_snapshots = 2;
+        struct sigaction sa, defaultHandler;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_sigaction = snapshotFaultHandler;
+        ASSERT_EQ(sigaction(SIGSEGV, &sa, &defaultHandler), 0);
+
+        const size_t B = FreeList::BlockSize;
+        GlobalAlloc *ga = GlobalAlloc::getInstance();
+        char *data = (char *)ga->alloc(3 * B);
+        ga->setBitmapForBigAlloc((uintptr_t)data, 3 * B);
+        for (size_t i = 0; i < 3; i++) memset(data + i * B, 'a' + i, B);
+        const size_t first = ((uintptr_t)data - GlobalAlloc::BaseAddress) / B;
+
+        Snapshot *ckpt = new Snapshot(PMEM_PATH);
+        uint32_t full = ckpt->create();
+        delete ckpt;
+        data[B + 100] = 'X'; // second block only
+        ckpt = new Snapshot(PMEM_PATH);
+        uint32_t delta = ckpt->create();
+
+        // Only the dirty block is saved by the incremental snapshot
+        loadSnapshot(ckpt, delta);
+        snapshot_header_t *view = getView(ckpt);
+        EXPECT_EQ(view->base_identifier, full);
+        const uint64_t *deltaMap = (const uint64_t *)((char *)view +
+                view->delta_offset);
+        for (size_t b = first; b < first + 3; b++) {
+            bool saved = (deltaMap[b >> 6] >> (b & 63)) & 1;
+            EXPECT_EQ(saved, b == first + 1);
+        }
+
+        // Overwrite the heap and restore it from the chain
+        memset(data, 'z', 3 * B);
+        restorePages(ckpt, ga->allocatedBlocks());
+        cleanEnvironment(ckpt);
+        EXPECT_EQ(data[0], 'a');
+        EXPECT_EQ(data[B - 1], 'a');
+        EXPECT_EQ(data[B], 'b');
+        EXPECT_EQ(data[B + 100], 'X');
+        EXPECT_EQ(data[B + 101], 'b');
+        EXPECT_EQ(data[2 * B], 'c');
+        EXPECT_EQ(data[3 * B - 1], 'c');
+        delete ckpt;
+
+        stopTracking();
+        ga->unsetBitmapForBigDealloc((uintptr_t)data, 3);
+        ga->release(data, 3 * B);
+        cfg->incremental_snapshots = incrementalSnapshots;
+        ASSERT_EQ(sigaction(SIGSEGV, &defaultHandler, NULL), 0);
+        removeSnapshot(full);
+        removeSnapshot(delta);
+    }
+
     TEST_F(SnapshotTestSuite, MarkPagesReadOnly) {
         // TODO
     }
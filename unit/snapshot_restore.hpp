@@ -0,0 +1,185 @@
+#include "restart.hpp"
+#include "../src/snapshot_restore.hpp"
+#include <signal.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    const size_t RestoreObjects = 4;
+    const size_t RestorePages = 8;
+    const size_t RestorePageSize = (size_t)1 << 20; // 1 MB
+    const char *const RestoreReport = PMEM_PATH "unit.report";
+    const char *const RestoreReportEnv =
+        "PRONTO_RECOVERY_REPORT=" PMEM_PATH "unit.report";
+
+    // Counter with heap memory of its own, saved by snapshots only
+    class RestartPages : public RestartCounter {
+    public:
+        RestartPages() : RestartCounter() { }
+        RestartPages(uuid_t id) : RestartCounter(id) { }
+
+        static PersistentObject *RecoveryFactory(NVManager *m, CatalogEntry *e) {
+            return newRestartObject<RestartPages>(e->uuid);
+        }
+
+        static uint64_t classID() { return 2; }
+
+        void fill(size_t object) {
+            for (size_t p = 0; p < RestorePages; p++) {
+                pages[p] = (char *)getAllocator()->alloc(RestorePageSize);
+                memset(pages[p], pageByte(object, p), RestorePageSize);
+            }
+        }
+
+        static char pageByte(size_t object, size_t page) {
+            return 'a' + object * RestorePages + page;
+        }
+
+        char *pages[RestorePages];
+    };
+
+    // Without waiting for recovery, i.e. its pages may not be restored yet
+    RestartPages *recoveredPages(size_t index) {
+        uuid_t id;
+        restartUUID(index, id);
+        NVManager &manager = NVManager::getInstance();
+        manager.lock();
+        RestartPages *obj = (RestartPages *)manager.findRecovered(id);
+        manager.unlock();
+        return obj;
+    }
+
+    // The first page of the first object is overwritten by phase "update"
+    void checkPages(RestartPages *obj, size_t object, bool updated) {
+        for (size_t p = 0; p < RestorePages; p++) {
+            char expected = RestartPages::pageByte(object, p);
+            if (updated && object == 0 && p == 0) expected = 'Z';
+            size_t i = 0;
+            while (i < RestorePageSize && obj->pages[p][i] == expected) i++;
+            EXPECT_EQ(i, RestorePageSize) << "object " << object << " page " << p;
+        }
+    }
+
+    uint64_t reportValue(const std::string &report, const char *name) {
+        std::string key = std::string("\"") + name + "\":";
+        size_t pos = report.find(key);
+        if (pos == std::string::npos) return 0;
+        return strtoull(report.c_str() + pos + key.size(), NULL, 10);
+    }
+
+    TEST(RestartPhase, DISABLED_SnapshotRestore) {
+        PersistentFactory::registerFactory<RestartPages>();
+
+        if (isPhase("create")) {
+            for (size_t i = 0; i < RestoreObjects; i++) {
+                RestartPages *obj = restartObject<RestartPages>(i);
+                obj->fill(i);
+                obj->add(i + 1);
+            }
+            NVManager::getInstance().shutdownCheckpoint();
+            endPhase(false);
+        }
+
+        if (isPhase("lazy")) {
+            NVManager &manager = NVManager::getInstance();
+            std::vector<RestartPages *> objects;
+            for (size_t i = 0; i < RestoreObjects; i++) {
+                objects.push_back(recoveredPages(i));
+            }
+
+            /*
+             * Restored while prefetch threads run: the blocks of an object
+             * like recovery threads do, and blocks touched by this thread
+             * (on fault, unless already restored)
+             */
+            SnapshotRestore::restoreObject(objects[0]->getAllocator());
+            checkPages(objects[0], 0, false);
+            checkPages(objects[1], 1, false);
+
+            manager.waitForRecovery();
+            for (size_t i = 0; i < RestoreObjects; i++) {
+                manager.waitForObject(objects[i]);
+                checkPages(objects[i], i, false);
+                EXPECT_EQ(objects[i]->value(), i + 1);
+            }
+            endPhase(false);
+        }
+
+        if (isPhase("eager")) {
+            for (size_t i = 0; i < RestoreObjects; i++) {
+                RestartPages *obj = restartObject<RestartPages>(i);
+                checkPages(obj, i, false);
+                EXPECT_EQ(obj->value(), i + 1);
+            }
+            endPhase(false);
+        }
+
+        // A full snapshot, then an incremental one that saves the update
+        if (isPhase("update")) {
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_flags = SA_SIGINFO;
+            sigemptyset(&sa.sa_mask);
+            sa.sa_sigaction = snapshotFaultHandler; // see snapshot.hpp
+            ASSERT_EQ(sigaction(SIGSEGV, &sa, NULL), 0);
+
+            NVManager &manager = NVManager::getInstance();
+            std::vector<RestartPages *> objects;
+            for (size_t i = 0; i < RestoreObjects; i++) {
+                objects.push_back(restartObject<RestartPages>(i));
+            }
+            manager.shutdownCheckpoint();
+            memset(objects[0]->pages[0], 'Z', RestorePageSize);
+            manager.shutdownCheckpoint();
+            endPhase(false);
+        }
+
+        if (isPhase("fallback")) {
+            for (size_t i = 0; i < RestoreObjects; i++) {
+                checkPages(restartObject<RestartPages>(i), i, true);
+            }
+            endPhase(false);
+        }
+        FAIL() << "Unknown phase";
+    }
+
+    /*
+     * The heap is restored from a snapshot on demand (userfaultfd), or
+     * copied on startup: eagerly, or as the fallback for incremental
+     * snapshots. Either way, restoring the same snapshot restores the same
+     * blocks, whichever thread (fault handler, recovery or prefetch) does.
+     */
+    TEST_F(RestartTest, SnapshotRestore) {
+        ASSERT_TRUE(runPhase("SnapshotRestore", "create"));
+        ASSERT_TRUE(runPhase("SnapshotRestore", "lazy", { RestoreReportEnv,
+                    "PRONTO_SNAPSHOT_RESTORE=lazy", "PRONTO_RECOVERY=lazy" }));
+        ASSERT_TRUE(runPhase("SnapshotRestore", "eager", { RestoreReportEnv,
+                    "PRONTO_SNAPSHOT_RESTORE=eager" }));
+        ASSERT_TRUE(runPhase("SnapshotRestore", "update",
+                    { "PRONTO_INCREMENTAL_SNAPSHOTS=2" }));
+        ASSERT_TRUE(runPhase("SnapshotRestore", "fallback", { RestoreReportEnv,
+                    "PRONTO_SNAPSHOT_RESTORE=lazy" }));
+
+        // One report per phase, in order
+        std::vector<std::string> reports;
+        std::ifstream file(RestoreReport);
+        for (std::string line; std::getline(file, line); ) {
+            reports.push_back(line);
+        }
+        ASSERT_EQ(reports.size(), (size_t)3);
+        EXPECT_NE(reports[0].find("\"mode\":\"lazy\""), std::string::npos);
+        EXPECT_NE(reports[1].find("\"mode\":\"eager\""), std::string::npos);
+        EXPECT_NE(reports[2].find("\"mode\":\"eager\""), std::string::npos);
+
+        uint64_t bytes = reportValue(reports[1], "bytes");
+        EXPECT_GE(bytes, RestoreObjects * RestorePages * RestorePageSize);
+        EXPECT_EQ(reportValue(reports[0], "bytes"), bytes);
+        uint64_t blocks = reportValue(reports[0], "faulted_blocks") +
+            reportValue(reports[0], "object_blocks") +
+            reportValue(reports[0], "prefetched_blocks");
+        EXPECT_GE(blocks, bytes / FreeList::BlockSize);
+    }
+}
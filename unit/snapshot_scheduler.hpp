@@ -0,0 +1,37 @@
+#include "../src/snapshot_scheduler.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+
+    const uint64_t MB = (uint64_t)1 << 20;
+    const uint64_t Second = 1000000000; // ns
+
+    TEST(SnapshotSchedulerTest, PredictReplay) {
+        // 100 ms objective, 1 s interval, 100 MB/s, 4 threads
+        SnapshotScheduler scheduler(Second / 10, Second, 100 * MB, 4);
+
+        // Logs are replayed in parallel
+        EXPECT_EQ(scheduler.predictReplay(400 * MB, 100 * MB), Second);
+        EXPECT_EQ(scheduler.predictReplay(400 * MB, 10 * MB), Second);
+        // The largest log is replayed by a single thread
+        EXPECT_EQ(scheduler.predictReplay(400 * MB, 200 * MB), 2 * Second);
+    }
+
+    TEST(SnapshotSchedulerTest, DueAtObjective) {
+        SnapshotScheduler scheduler(Second / 10, Second, 100 * MB, 1);
+        const uint64_t now = 10 * Second;
+
+        // Nothing to replay, then 50 ms and 80 ms of replay (75% = 75 ms)
+        EXPECT_FALSE(scheduler.isDue(now, 0, 0));
+        EXPECT_FALSE(scheduler.isDue(now, 5 * MB, 5 * MB));
+        EXPECT_TRUE(scheduler.isDue(now, 8 * MB, 8 * MB));
+    }
+
+    TEST(SnapshotSchedulerTest, MinimumInterval) {
+        SnapshotScheduler scheduler(Second / 10, Second, 100 * MB, 1);
+        scheduler.snapshotTaken(10 * Second);
+
+        EXPECT_FALSE(scheduler.isDue(10 * Second + Second / 2, 64 * MB, 64 * MB));
+        EXPECT_TRUE(scheduler.isDue(11 * Second, 64 * MB, 64 * MB));
+    }
+}
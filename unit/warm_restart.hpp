@@ -0,0 +1,80 @@
+#include "restart.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    const size_t WarmObjects = 4;
+    const size_t WarmRounds = 1000;
+    const char *const WarmHeapEnv = "PRONTO_WARM_HEAP=" PMEM_PATH "unit.heap";
+    const char *const WarmHeapPath = PMEM_PATH "unit.heap";
+
+    uint64_t warmValue(size_t object) {
+        return WarmRounds * (object + 1);
+    }
+
+    void checkWarmValues(std::vector<RestartCounter *> &objects) {
+        for (size_t i = 0; i < WarmObjects; i++) {
+            EXPECT_EQ(objects[i]->value(), warmValue(i));
+        }
+    }
+
+    TEST(RestartPhase, DISABLED_WarmRestart) {
+        PersistentFactory::registerFactory<RestartCounter>();
+        std::vector<RestartCounter *> objects;
+        for (size_t i = 0; i < WarmObjects; i++) {
+            objects.push_back(restartObject<RestartCounter>(i));
+        }
+
+        if (isPhase("create")) {
+            for (size_t r = 0; r < WarmRounds; r++) {
+                for (size_t i = 0; i < WarmObjects; i++) objects[i]->add(i + 1);
+            }
+        }
+        else if (isPhase("warm")) {
+            checkWarmValues(objects);
+            EXPECT_EQ(RestartCounter::played, (uint64_t)0);
+        }
+        else if (isPhase("cold")) {
+            checkWarmValues(objects);
+            EXPECT_EQ(RestartCounter::played, WarmObjects * WarmRounds);
+        }
+        else FAIL() << "Unknown phase";
+
+        NVManager::getInstance().saveWarmState();
+        endPhase(false);
+    }
+
+    /*
+     * The heap file is only reused if it holds the heap saved along with the
+     * warm state, otherwise (e.g., a stale or emptied file) logs are replayed
+     */
+    TEST_F(RestartTest, WarmRestart) {
+        ASSERT_TRUE(runPhase("WarmRestart", "create", { WarmHeapEnv }));
+        ASSERT_TRUE(runPhase("WarmRestart", "warm", { WarmHeapEnv }));
+        ASSERT_TRUE(runPhase("WarmRestart", "warm", { WarmHeapEnv }));
+
+        // Another generation of the heap, same size
+        int fd = open(WarmHeapPath, O_RDWR);
+        ASSERT_GE(fd, 0);
+        heap_file_header_t header;
+        ASSERT_EQ(pread(fd, &header, sizeof(header), 0),
+                (ssize_t)sizeof(header));
+        header.generation[0] ^= 0xff;
+        ASSERT_EQ(pwrite(fd, &header, sizeof(header), 0),
+                (ssize_t)sizeof(header));
+        close(fd);
+        ASSERT_TRUE(runPhase("WarmRestart", "cold", { WarmHeapEnv }));
+        ASSERT_TRUE(runPhase("WarmRestart", "warm", { WarmHeapEnv }));
+
+        // Empty file, e.g., a tmpfs after a reboot
+        ASSERT_EQ(truncate(WarmHeapPath, 0), 0);
+        ASSERT_TRUE(runPhase("WarmRestart", "cold", { WarmHeapEnv }));
+
+        // No file
+        ASSERT_EQ(unlink(WarmHeapPath), 0);
+        ASSERT_TRUE(runPhase("WarmRestart", "cold", { WarmHeapEnv }));
+        ASSERT_TRUE(runPhase("WarmRestart", "warm", { WarmHeapEnv }));
+    }
+}